@@ -93,6 +93,9 @@ sd_plugin_main (void **data)
             {
                 cmd->argcf += p.we_wordc - 1;
                 cmd->argvf = xrealloc (cmd->argvf,cmd->argcf * sizeof(char *));
+                /* the following arguments check their slot before use */
+                memset (cmd->argvf + cmd->argcf - (p.we_wordc - 1), 0,
+                        (p.we_wordc - 1) * sizeof (char *));
             }
             for (j = 0; j < (int) p.we_wordc; j++)
                 cmd->argvf[k+j] = xstrdup (p.we_wordv[j]);
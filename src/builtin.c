@@ -42,6 +42,9 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "xutils.h"
 #include "builtin.h"
@@ -49,6 +52,15 @@
 #include "jobs.h"
 #include "modules.h"
 #include "command.h"
+#include "options.h"
+#include "relay.h"
+#include "memo.h"
+#include "trace.h"
+#include "onchange.h"
+#include "evloop.h"
+#include "scan.h"
+#include "throttle.h"
+#include "capture.h"
 #include "sdlib/plugin.h"
 
 #define open_filestream()                  \
@@ -79,6 +91,7 @@ do{                                        \
 #define sd_printerr(...) fprintf(fderr,__VA_ARGS__)
 
 extern int ret_code;
+extern unsigned int interrupted;
 extern command *curr;
 
 extern int nb_found;
@@ -96,11 +109,75 @@ sd_exit (int argc, char **argv, int in, int out, int err)
     exit (strtoul (argv[0], NULL, 0));
 }
 
+/*
+ * jobs output [-f] %N: what a job wrote while its output was kept (cf.
+ * jobs.capture). With -f, what it writes next follows until it ends
+ */
+static int
+print_job_output (int argc, char **argv, FILE *fdout, FILE *fderr)
+{
+    unsigned int follow = FALSE;
+    unsigned long long pos = 0;
+    int i, j, ring;
+    job *tmp;
+    pid_t pid;
+    for (i = 0; i < argc - 1; i++)
+        if (xstrcmp (argv[i], "-f") == 0 || xstrcmp (argv[i], "--follow") == 0)
+            follow = TRUE;
+        else
+            break;
+    if (i != argc - 1)
+    {
+        sd_printerr ("usage:\n\tjobs output [-f] %%N\n");
+        return 1;
+    }
+    j = strtol (argv[i] + (argv[i][0] == '%'), NULL, 10);
+    ring = job_output (j);
+    if (ring < 0)
+    {
+        sd_printerr ("jobs output: '%s' no output kept\n", argv[i]);
+        return 1;
+    }
+    /* the ring goes away with the job once its id is given again */
+    ring = fcntl (ring, F_DUPFD_CLOEXEC, 0);
+    if (ring < 0)
+    {
+        sd_printerr ("jobs output: %s\n", strerror (errno));
+        return 1;
+    }
+    fflush (fdout);
+    capture_print (ring, fileno (fdout), &pos);
+    tmp = get_job_by_job_id (j);
+    pid = tmp != NULL ? tmp->content->pid : -1;
+    /* the job is collected as soon as it ends, its relay with it */
+    while (follow && pid > 0 && !interrupted)
+    {
+        evloop_wait (100);
+        reap_jobs (FALSE);
+        fflush (stdout);
+        capture_print (ring, fileno (fdout), &pos);
+        tmp = get_job_by_job_id (j);
+        if (tmp == NULL || tmp->content->pid != pid)
+            break;
+    }
+    close (ring);
+    return 0;
+}
+
 int
 sd_jobs (int argc, char **argv, int in, int out, int err)
 {
     unsigned int opts = TRUE;
     int i;
+
+    if (argc > 0 && xstrcmp (argv[0], "output") == 0)
+    {
+        open_filestream ();
+        i = print_job_output (argc - 1, argv + 1, fdout, fderr);
+        close_filestream ();
+        (void) in;
+        return i;
+    }
     for (i = 0; i < argc; i++)
         opts = (xstrcmp (argv[i], "-l") == 0 ||
                 xstrcmp (argv[i], "--long") == 0);
@@ -294,18 +371,48 @@ is executed lately.\n");
     return 0;
 }
 
+/* Job designated by '%N' or by its pid */
+static job *
+find_job (const char *spec)
+{
+    if (spec[0] == '%')
+        return get_job_by_job_id (strtol (spec + 1, NULL, 10));
+    return get_job_by_pid (strtoul (spec, NULL, 10));
+}
+
 int
 sd_bg (int argc, char **argv, int in, int out, int err)
 {
-    int ret = 0;
+    int ret = 0, share = -1;
 
     open_filestream ();
 
+    /* --cpu N%: keep it to N% of a CPU (0 lifts the cap) */
+    if (argc > 0 && xstrcmp (argv[0], "--cpu") == 0)
+    {
+        char *end = NULL;
+        if (argc > 1)
+            share = strtol (argv[1], &end, 10);
+        if (argc < 2 || end == argv[1] || share < 0 ||
+            (*end != '\0' && xstrcmp (end, "%") != 0))
+        {
+            sd_printerr ("bg: '%s' invalid CPU share\n",
+                         argc > 1 ? argv[1] : "");
+            sd_print ("usage:\n\tbg [--cpu N%%] [%%job|pid ...]\n");
+            close_filestream ();
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
     if (argc == 0)
     {
         command *tmp = get_last_enqueued_job (FALSE);
         if (tmp != NULL)
         {
+            if (share >= 0)
+                cap_job (get_last_job (), share);
             tmp->continued = TRUE;
             if (tmp->stopped)
             {
@@ -314,7 +421,7 @@ sd_bg (int argc, char **argv, int in, int out, int err)
                           tmp->pid,
                           tmp->cmd);
                 tmp->stopped = FALSE;
-                kill (tmp->pid, SIGCONT);
+                kill_tree (tmp, SIGCONT);
             }
         }
         else
@@ -328,10 +435,13 @@ sd_bg (int argc, char **argv, int in, int out, int err)
         int i;
         for (i = 0; i < argc; i++)
         {
-            int index = index_of (strtoul (argv[i], NULL, 10));
-            job *tmp = get_job (index);
+            job *tmp = find_job (argv[i]);
+            if (tmp != NULL && tmp->queued && !launch_job (tmp))
+                continue;
             if (tmp != NULL)
             {
+                if (share >= 0)
+                    cap_job (tmp, share);
                 tmp->content->continued = TRUE;
                 if (tmp->content->stopped)
                 {
@@ -342,7 +452,7 @@ sd_bg (int argc, char **argv, int in, int out, int err)
                               tmp->content->pid,
                               tmp->content->cmd);
                     tmp->content->stopped = FALSE;
-                    kill (tmp->content->pid, SIGCONT);
+                    kill_tree (tmp->content, SIGCONT);
                 }
             }
             else
@@ -359,6 +469,161 @@ sd_bg (int argc, char **argv, int in, int out, int err)
     return ret;
 }
 
+/* Exit status of a command from its waitpid status */
+static int
+exit_code (int status)
+{
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return WEXITSTATUS(status);
+}
+
+/* Write what a job kept of its output (cf. jobs.capture) once it ended */
+static void
+replay_job (job *j, FILE *fdout)
+{
+    unsigned long long pos = 0;
+    if (j == NULL || j->content->capture < 0)
+        return;
+    wait_relays (j->content);
+    fflush (fdout);
+    capture_print (j->content->capture, fileno (fdout), &pos);
+    /* given already: not worth keeping for 'jobs output' */
+    close (j->content->capture);
+    j->content->capture = -1;
+}
+
+/*
+ * Wait for a command brought to the foreground. When its output is kept, what
+ * it wrote so far is replayed then what it writes follows
+ */
+static pid_t
+wait_fg (command *ptr, int *status, FILE *fdout)
+{
+    unsigned long long pos = 0;
+    pid_t r;
+    if (ptr->capture < 0)
+    {
+        r = wait_foreground (ptr->pid, status, 0);
+        wait_relays (ptr);
+        /* the jobs waiting for it (cf. after) are not in foreground */
+        if (r == ptr->pid)
+            job_exited (r, *status);
+        return r;
+    }
+    fflush (fdout);
+    r = capture_wait (ptr, status, fileno (fdout), &pos);
+    /* the end of it may still be on its way to the ring */
+    wait_relays (ptr);
+    capture_print (ptr->capture, fileno (fdout), &pos);
+    if (r == ptr->pid)
+        job_exited (r, *status);
+    return r;
+}
+
+/*
+ * fg with several jobs: they are all continued, then waited for together
+ * through their pidfds instead of one after the other
+ */
+static int
+fg_jobs (int argc, char **argv, FILE *fdout, FILE *fderr)
+{
+    int i, left = 0, ret = 254;
+    pid_t *pids = xcalloc (argc, sizeof (pid_t));
+    int *fds = xcalloc (argc, sizeof (int));
+    int *codes = xcalloc (argc, sizeof (int));
+    /* ^Z stops the shell's wait, not a job in particular */
+    void (*stop) (int) = signal (SIGTSTP, SIG_IGN);
+    for (i = 0; i < argc; i++)
+    {
+        job *tmp = find_job (argv[i]);
+        fds[i] = -1;
+        codes[i] = 254;
+        if (tmp != NULL && tmp->queued && !launch_job (tmp))
+            continue;
+        if (tmp == NULL)
+        {
+            sd_printerr ("fg: '%s' no such process\n", argv[i]);
+            continue;
+        }
+        /* in foreground like with a single job, the caps are lifted */
+        uncap_job (tmp);
+        tmp->throttled = FALSE;
+        tmp->foreground = TRUE;
+        tmp->content->continued = TRUE;
+        if (tmp->content->stopped)
+        {
+            const char l = (tmp == get_last_job ()) ? '+' : '-';
+            sd_print ("[%d]  %c continued %d (%s)\n",
+                      tmp->content->job,
+                      l,
+                      tmp->content->pid,
+                      tmp->content->cmd);
+            tmp->content->stopped = FALSE;
+            kill_tree (tmp->content, SIGCONT);
+        }
+        pids[i] = tmp->content->pid;
+        if (tmp->content->pidfd >= 0 &&
+            evloop_add (tmp->content->pidfd, NULL, NULL) == 0)
+        {
+            fds[i] = tmp->content->pidfd;
+            left++;
+        }
+    }
+    /* readable once the process ended: its pid is still its own */
+    while (left > 0)
+    {
+        int status, fd = evloop_wait (-1);
+        if (fd < 0)
+        {
+            if (errno == EINTR && interrupted)
+                break;
+            continue;
+        }
+        for (i = 0; i < argc && fds[i] != fd; i++);
+        if (i == argc)
+            continue;
+        evloop_del (fd);
+        fds[i] = -1;
+        left--;
+        if (waitpid (pids[i], &status, 0) == pids[i])
+        {
+            replay_job (get_job_by_pid (pids[i]), fdout);
+            end_job (get_job_by_pid (pids[i]), status, TRUE);
+            codes[i] = exit_code (status);
+        }
+    }
+    /* the jobs without pidfd, one after the other */
+    for (i = 0; i < argc && !interrupted; i++)
+    {
+        int status;
+        if (pids[i] <= 0 || codes[i] != 254 || fds[i] >= 0)
+            continue;
+        if (wait_foreground (pids[i], &status, 0) == pids[i])
+        {
+            replay_job (get_job_by_pid (pids[i]), fdout);
+            end_job (get_job_by_pid (pids[i]), status, TRUE);
+            codes[i] = exit_code (status);
+        }
+    }
+    /* interrupted: the jobs left keep running in background */
+    for (i = 0; i < argc; i++)
+    {
+        job *tmp = pids[i] > 0 ? get_job_by_pid (pids[i]) : NULL;
+        if (fds[i] >= 0)
+            evloop_del (fds[i]);
+        if (tmp != NULL)
+            tmp->foreground = FALSE;
+    }
+    signal (SIGTSTP, stop);
+    if (left == 0 && !interrupted)
+        ret = codes[argc - 1];
+    xfree (pids);
+    xfree (fds);
+    xfree (codes);
+    return ret;
+}
+
 int
 sd_fg (int argc, char **argv, int in, int out, int err)
 {
@@ -380,16 +645,19 @@ sd_fg (int argc, char **argv, int in, int out, int err)
                           tmp->pid,
                           tmp->cmd);
                 tmp->stopped = FALSE;
-                kill (tmp->pid, SIGCONT);
+                kill_tree (tmp, SIGCONT);
             }
             signal (SIGTSTP, sigstophandler);
             curr = tmp;
 
             p = tmp->pid;
 
-            r = waitpid (p, &status, 0);
+            r = wait_fg (tmp, &status, fdout);
             if (r != -1)
-                ret_code = WEXITSTATUS(status);
+            {
+                trace_exit (p, status);
+                ret_code = exit_code (status);
+            }
             else
                 ret_code = 254;
 
@@ -401,6 +669,8 @@ sd_fg (int argc, char **argv, int in, int out, int err)
             ret_code = 254;
         }
     }
+    else if (argc > 1)
+        ret_code = fg_jobs (argc, argv, fdout, fderr);
     else
     {
         int i;
@@ -408,8 +678,13 @@ sd_fg (int argc, char **argv, int in, int out, int err)
         {
             int status;
             int r;
-            int index = index_of (strtoul (argv[i], NULL, 10));
-            job *tmp = get_job (index);
+            job *tmp = find_job (argv[i]);
+            /* asked for by name: it does not wait for a slot any longer */
+            if (tmp != NULL && tmp->queued && !launch_job (tmp))
+            {
+                ret_code = 254;
+                continue;
+            }
             if (tmp != NULL)
             {
                 pid_t p;
@@ -423,17 +698,20 @@ sd_fg (int argc, char **argv, int in, int out, int err)
                               tmp->content->pid,
                               tmp->content->cmd);
                     tmp->content->stopped = FALSE;
-                    kill (tmp->content->pid, SIGCONT);
+                    kill_tree (tmp->content, SIGCONT);
                 }
                 signal (SIGTSTP, sigstophandler);
-                curr = copy_command (tmp->content);
-                remove_job (index);
+                curr = ref_command (tmp->content);
+                remove_job (tmp);
 
                 p = curr->pid;
 
-                r = waitpid (p, &status, 0);
+                r = wait_fg (curr, &status, fdout);
                 if (r != -1)
-                    ret_code = WEXITSTATUS(status);
+                {
+                    trace_exit (p, status);
+                    ret_code = exit_code (status);
+                }
                 else
                     ret_code = 254;
 
@@ -698,3 +976,939 @@ sd_exec (int argc, char **argv, int in, int out, int err)
 
     return 1;
 }
+
+int
+sd_set (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0;
+    open_filestream ();
+
+    if (argc == 0)
+    {
+        int i;
+        const option *opt;
+        for (i = 0; (opt = get_option_by_index (i)) != NULL; i++)
+            sd_print ("%-16s %-12s # %s\n",
+                      opt->key,
+                      opt->value != NULL ? opt->value : "",
+                      opt->desc);
+    }
+    else if (argc == 1 && (xstrcmp (argv[0], "-x") == 0 || 
+                           xstrcmp (argv[0], "+x") == 0))
+    {
+        set_option ("trace", argv[0][0] == '-' ? "on" : "off");
+        trace_configure ();
+    }
+    else if (argc == 1)
+    {
+        const char *value = get_option (argv[0]);
+        if (value == NULL)
+        {
+            sd_printerr ("set: '%s' no such option\n", argv[0]);
+            ret = 1;
+        }
+        else
+            sd_print ("%s\n", value);
+    }
+    else if (argc == 2)
+    {
+        switch (set_option (argv[0], argv[1]))
+        {
+        case 1:
+            sd_printerr ("set: '%s' no such option\n", argv[0]);
+            ret = 1;
+            break;
+        case 2:
+            sd_printerr ("set: '%s' invalid value for '%s'\n",
+                         argv[1],
+                         argv[0]);
+            ret = 2;
+            break;
+        }
+        if (ret == 0 && strncmp (argv[0], "trace", 5) == 0)
+            trace_configure ();
+        if (ret == 0 && strncmp (argv[0], "loop.", 5) == 0)
+            evloop_configure ();
+        /* a higher jobs.max leaves room to the queued jobs */
+        if (ret == 0 && strncmp (argv[0], "jobs.", 5) == 0)
+        {
+            throttle_configure ();
+            admit_jobs ();
+        }
+    }
+    else
+    {
+        sd_printerr ("set: too many arguments\n");
+        sd_print ("usage:\n\tset [option [value]]\n\tset -x|+x\n");
+        ret = 1;
+    }
+
+    close_filestream ();
+    (void) in;
+
+    return ret;
+}
+
+int
+sd_tee (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0, i, nb = 1, flags = O_CREAT|O_WRONLY|O_TRUNC;
+    int *targets = xcalloc (argc + 1, sizeof (int));
+    open_filestream ();
+
+    targets[0] = out;
+    for (i = 0; i < argc; i++)
+    {
+        if (xstrcmp (argv[i], "-a") == 0)
+        {
+            flags = O_CREAT|O_WRONLY|O_APPEND;
+            continue;
+        }
+        targets[nb] = open (argv[i], flags, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP);
+        if (targets[nb] < 0)
+        {
+            sd_printerr ("tee: %s: %s\n", argv[i], strerror (errno));
+            ret = 1;
+            continue;
+        }
+        nb++;
+    }
+    if (relay (in, targets, nb) != 0)
+    {
+        sd_printerr ("tee: %s\n", strerror (errno));
+        ret = 1;
+    }
+    for (i = 1; i < nb; i++)
+        close (targets[i]);
+    xfree (targets);
+
+    close_filestream ();
+
+    return ret;
+}
+
+/**
+ * Run the command of 'memo' with its outputs captured in spools
+ * @return The exit status of the command, -1 if it did not exit normally
+ */
+static int
+memo_run (int argc, char **argv, int in, int out, int err)
+{
+    command_line *cl = run_argv (argc, argv, in, out, err);
+    pid_t p = cl->content->pid;
+    int status, ret = -1;
+    if (p != -1 && !cl->content->builtin)
+    {
+        if (waitpid (p, &status, 0) == p && WIFEXITED(status))
+            ret = WEXITSTATUS(status);
+    }
+    else if (p != -1)
+        ret = ret_code;
+    free_cmd_line (cl);
+    return ret;
+}
+
+int
+sd_memo (int argc, char **argv, int in, int out, int err)
+{
+    char **vars = xcalloc (argc + 1, sizeof (char *));
+    char **inputs = xcalloc (argc + 1, sizeof (char *));
+    int i, ret, nb_vars = 0, nb_inputs = 0, spout, sperr;
+    char *key = NULL;
+    size_t len;
+    open_filestream ();
+
+    for (i = 0; i < argc; i++)
+    {
+        if (xstrcmp (argv[i], "-i") == 0 && i + 1 < argc)
+            inputs[nb_inputs++] = argv[++i];
+        else if (xstrcmp (argv[i], "-e") == 0 && i + 1 < argc)
+            vars[nb_vars++] = argv[++i];
+        else
+        {
+            if (xstrcmp (argv[i], "--") == 0)
+                i++;
+            break;
+        }
+    }
+    if (i >= argc)
+    {
+        sd_printerr ("memo: missing command\n");
+        sd_print ("usage:\n\tmemo [-i input]... [-e variable]... "
+                  "[--] command [args]\n");
+        ret = 1;
+        goto end;
+    }
+    key = memo_key (argc - i, argv + i, vars, nb_vars, inputs, nb_inputs,
+                    &len);
+    if ((ret = memo_replay (key, len, out, err)) >= 0)
+        goto end;
+    spout = memo_spool ();
+    sperr = memo_spool ();
+    if (spout < 0 || sperr < 0)
+    {
+        sd_printerr ("memo: %s\n", strerror (errno));
+        ret = 254;
+    }
+    else
+    {
+        ret = memo_run (argc - i, argv + i, in, spout, sperr);
+        /* a command killed by a signal is not worth remembering */
+        if (ret >= 0)
+            memo_store (key, len, spout, sperr, ret);
+        else
+            ret = 254;
+        memo_unspool (spout, out);
+        memo_unspool (sperr, err);
+    }
+    if (spout >= 0)
+        close (spout);
+    if (sperr >= 0)
+        close (sperr);
+
+end:
+    xfree (key);
+    xfree (vars);
+    xfree (inputs);
+    close_filestream ();
+
+    return ret;
+}
+
+int
+sd_trace (int argc, char **argv, int in, int out, int err)
+{
+    unsigned int json = FALSE;
+    const char *path = trace_path ();
+    int ret = 0, i;
+    open_filestream ();
+
+    for (i = 0; i < argc; i++)
+    {
+        if (xstrcmp (argv[i], "-j") == 0)
+            json = TRUE;
+        else
+            path = argv[i];
+    }
+    if (path == NULL)
+    {
+        sd_printerr ("trace: the trace is off (cf. set -x)\n");
+        sd_print ("usage:\n\ttrace [-j] [file]\n");
+        ret = 1;
+    }
+    else if (trace_dump (path, json, fdout) != 0)
+    {
+        sd_printerr ("trace: '%s' is not a trace\n", path);
+        ret = 1;
+    }
+
+    close_filestream ();
+    (void) in;
+
+    return ret;
+}
+
+int
+sd_onchange (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0, i;
+    open_filestream ();
+
+    for (i = 0; i < argc; i++)
+        if (xstrcmp (argv[i], "--") == 0)
+            break;
+    if (i == 0 || i >= argc - 1)
+    {
+        sd_printerr ("onchange: missing %s\n", i == 0 ? "path" : "command");
+        sd_print ("usage:\n\tonchange path... -- command [args]\n");
+        ret = 1;
+    }
+    else if (onchange (argv, i, argc - i - 1, argv + i + 1) != 0)
+        ret = 1;
+
+    close_filestream ();
+    (void) in;
+
+    return ret;
+}
+
+int
+sd_wait (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0, nb = 0, left = 0, done = -1, i;
+    unsigned int any = FALSE;
+    job *next;
+    pid_t *pids;
+    int *codes, *fds;
+    open_filestream ();
+
+    if (argc > 0 && xstrcmp (argv[0], "-n") == 0)
+    {
+        any = TRUE;
+        argc--;
+        argv++;
+    }
+    /* without argument, wait for every job, the queued ones too */
+    if (argc == 0)
+    {
+        flush_queue (0);
+        nb = nb_jobs ();
+    }
+    else
+        nb = argc;
+    next = get_first_job ();
+    pids = xcalloc (nb, sizeof (pid_t));
+    codes = xcalloc (nb, sizeof (int));
+    fds = xcalloc (nb, sizeof (int));
+    for (i = 0; i < nb; i++)
+    {
+        codes[i] = -1;
+        fds[i] = -1;
+    }
+    /*
+     * walking the list, the jobs an ended one releases must not leave it
+     * under 'next' (the operands are looked up one by one)
+     */
+    if (argc == 0)
+        hold_jobs ();
+    for (i = 0; i < nb && done < 0; i++)
+    {
+        int status, id = -1;
+        pid_t pid = 0;
+        job *j;
+        /* the job may end in the loop: step to the next one first */
+        if (argc == 0)
+        {
+            j = next;
+            next = j != NULL ? j->next : NULL;
+        }
+        else if (argv[i][0] == '%')
+        {
+            id = strtol (argv[i] + 1, NULL, 10);
+            j = get_job_by_job_id (id);
+            /* it has to start before it can end */
+            if (j != NULL && j->queued)
+            {
+                flush_queue (id);
+                j = get_job_by_job_id (id);
+                if (j != NULL && j->queued)
+                {
+                    codes[i] = 130;
+                    continue;
+                }
+            }
+        }
+        else
+        {
+            pid = strtol (argv[i], NULL, 10);
+            j = get_job_by_pid (pid);
+        }
+        if (j != NULL)
+        {
+            pids[i] = j->content->pid;
+            /* 
+             * a pidfd becomes readable once the process ended, even before
+             * the call: its status is still there to collect
+             */
+            fds[i] = syscall (SYS_pidfd_open, pids[i], 0);
+            if (fds[i] >= 0 && evloop_add (fds[i], NULL, NULL) != 0)
+            {
+                close (fds[i]);
+                fds[i] = -1;
+            }
+            if (fds[i] >= 0)
+                left++;
+            else if (waitpid (pids[i], &status, 0) == pids[i])
+            {
+                /* no pidfd: block on the jobs one after the other */
+                end_job (get_job_by_pid (pids[i]), status, TRUE);
+                codes[i] = exit_code (status);
+                if (any)
+                    done = i;
+            }
+        }
+        /* the job may have ended and been reported before the call */
+        else if (forget_job (pid, id, &status))
+        {
+            codes[i] = exit_code (status);
+            if (any)
+                done = i;
+        }
+        else
+        {
+            sd_printerr ("wait: '%s' no such job\n", argv[i]);
+            codes[i] = 127;
+        }
+    }
+    if (argc == 0)
+        release_jobs ();
+    while (left > 0 && done < 0)
+    {
+        int status, fd = evloop_wait (-1); 
+        if (fd < 0)
+        {
+            if (errno == EINTR && interrupted)
+                break;
+            continue;
+        }
+        for (i = 0; i < nb && fds[i] != fd; i++);
+        if (i == nb)
+            continue;
+        if (waitpid (pids[i], &status, 0) == pids[i])
+        {
+            end_job (get_job_by_pid (pids[i]), status, TRUE);
+            codes[i] = exit_code (status);
+        }
+        evloop_del (fd);
+        close (fd);
+        fds[i] = -1;
+        left--;
+        /* leave the other jobs for the next 'wait -n' */
+        if (any)
+            done = i;
+    }
+    /* -n: the status is the one of the first job that ended */
+    if (any)
+        ret = done >= 0 ? codes[done] : left > 0 ? 130 : 127;
+    else if (left > 0)
+        ret = 130;
+    /* waiting for every job succeeds, whatever they returned */
+    else if (argc == 0)
+        ret = 0;
+    /* otherwise, the status is the one of the last job listed */
+    else if (nb > 0 && codes[nb - 1] >= 0)
+        ret = codes[nb - 1];
+    for (i = 0; i < nb; i++)
+    {
+        if (fds[i] < 0)
+            continue;
+        evloop_del (fds[i]);
+        close (fds[i]);
+    }
+    xfree (fds);
+    xfree (codes);
+    xfree (pids);
+    close_filestream ();
+    (void) in;
+
+    return ret;
+}
+
+/* Number of a signal given as a number or a name (ie. 9, KILL, SIGKILL) */
+static int
+signal_number (const char *name)
+{
+    char *end;
+    int i = strtol (name, &end, 10);
+    if (end != name && *end == '\0')
+        return i > 0 && i < NSIG ? i : -1;
+    if (strncmp (name, "SIG", 3) == 0)
+        name += 3;
+    for (i = 1; i < NSIG; i++)
+        if (xstrcmp (sigabbrev_np (i), name) == 0)
+            return i;
+    return -1;
+}
+
+int
+sd_kill (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0, sig = SIGTERM, i;
+    open_filestream ();
+
+    if (argc > 1 && xstrcmp (argv[0], "-s") == 0)
+    {
+        sig = signal_number (argv[1]);
+        argc -= 2;
+        argv += 2;
+    }
+    else if (argc > 0 && argv[0][0] == '-' && xstrcmp (argv[0], "--") != 0)
+    {
+        sig = signal_number (argv[0] + 1);
+        argc--;
+        argv++;
+    }
+    if (argc > 0 && xstrcmp (argv[0], "--") == 0)
+    {
+        argc--;
+        argv++;
+    }
+    if (sig < 0 || argc == 0)
+    {
+        if (sig < 0)
+            sd_printerr ("kill: invalid signal\n");
+        sd_print ("usage:\n\tkill [-s SIG|-SIG] %%job|pid ...\n");
+        close_filestream ();
+        return 1;
+    }
+    for (i = 0; i < argc; i++)
+    {
+        job *tmp = find_job (argv[i]);
+        char *end;
+        pid_t pid;
+        int r;
+        /* not started yet: nothing to signal, unless it is to end */
+        if (tmp != NULL && tmp->queued)
+        {
+            if (sig == SIGKILL || sig == SIGTERM || sig == SIGINT)
+            {
+                sd_print ("[%d] (%s) cancelled\n", tmp->content->job,
+                                                   tmp->content->cmd);
+                remove_job (tmp);
+            }
+            continue;
+        }
+        /* a job is reached through its pidfd, and so are its children */
+        else if (tmp != NULL)
+        {
+            r = kill_tree (tmp->content, sig);
+            /* a stopped job would only see it once continued */
+            if (r == 0 && tmp->content->stopped && sig != SIGSTOP &&
+                sig != SIGCONT && sig != SIGTSTP)
+            {
+                tmp->content->stopped = FALSE;
+                tmp->throttled = FALSE;
+                kill_tree (tmp->content, SIGCONT);
+            }
+        }
+        else if ((pid = strtol (argv[i], &end, 10)) <= 0 || *end != '\0')
+        {
+            sd_printerr ("kill: '%s' no such job\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        else
+            r = kill (pid, sig);
+        if (r != 0)
+        {
+            sd_printerr ("kill: '%s': %s\n", argv[i], strerror (errno));
+            ret = 1;
+        }
+    }
+
+    close_filestream ();
+    (void) in;
+    return ret;
+}
+
+/*
+ * after[-success] %N... -- cmd [args]: cmd becomes a job started once the
+ * given jobs ended. Given a waiting job instead (ie. after %1 -- %3), that job
+ * waits for them too
+ */
+static int
+after_jobs (const char *name, int argc, char **argv, unsigned int on_success,
+            int out, int err, FILE *fdout, FILE *fderr)
+{
+    job **deps;
+    int i, sep, nb = 0, ret = 0;
+    for (sep = 0; sep < argc && xstrcmp (argv[sep], "--") != 0; sep++);
+    if (sep == 0 || sep >= argc - 1)
+    {
+        sd_printerr ("usage:\n\t%s %%job... -- command [args]\n", name);
+        sd_printerr ("\t%s %%job... -- %%job\n", name);
+        return 1;
+    }
+    deps = xcalloc (sep, sizeof (job *));
+    for (i = 0; i < sep && ret == 0; i++)
+    {
+        job *tmp = find_job (argv[i]);
+        int status;
+        if (tmp != NULL)
+            deps[nb++] = tmp;
+        /* already over: nothing to wait for, unless it had to succeed */
+        else if (argv[i][0] == '%' &&
+                 ended_job_status (strtol (argv[i] + 1, NULL, 10), &status))
+        {
+            if (on_success && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+            {
+                sd_printerr ("%s: '%s' failed\n", name, argv[i]);
+                ret = 1;
+            }
+        }
+        else
+        {
+            sd_printerr ("%s: '%s' no such job\n", name, argv[i]);
+            ret = 1;
+        }
+    }
+    if (ret == 0 && sep == argc - 2 && argv[argc - 1][0] == '%')
+    {
+        job *tmp = find_job (argv[argc - 1]);
+        if (tmp == NULL || !tmp->queued)
+        {
+            sd_printerr ("%s: '%s' is not waiting\n", name, argv[argc - 1]);
+            ret = 1;
+        }
+        else if (add_deps (tmp, deps, nb, on_success) != 0)
+        {
+            sd_printerr ("%s: '%s' would wait for itself\n", name,
+                                                          argv[argc - 1]);
+            ret = 1;
+        }
+    }
+    else if (ret == 0)
+    {
+        command *ptr = new_command ();
+        set_argv (ptr, argc - sep - 1, argv + sep + 1);
+        /* the redirections of 'after' are the ones of the job */
+        if (out != STDOUT_FILENO)
+            ptr->out = fcntl (out, F_DUPFD_CLOEXEC, 0);
+        if (err != STDERR_FILENO)
+            ptr->err = fcntl (err, F_DUPFD_CLOEXEC, 0);
+        fflush (fdout);
+        after_job (ptr, deps, nb, on_success);
+        free_command (ptr);
+    }
+    xfree (deps);
+    return ret;
+}
+
+int
+sd_after (int argc, char **argv, int in, int out, int err)
+{
+    int ret;
+    open_filestream ();
+    ret = after_jobs ("after", argc, argv, FALSE, out, err, fdout, fderr);
+    close_filestream ();
+    (void) in;
+    return ret;
+}
+
+int
+sd_after_success (int argc, char **argv, int in, int out, int err)
+{
+    int ret;
+    open_filestream ();
+    ret = after_jobs ("after-success", argc, argv, TRUE, out, err, fdout,
+                      fderr);
+    close_filestream ();
+    (void) in;
+    return ret;
+}
+
+/**
+ * Hand the options the text builtins do not know to the real utility. They
+ * run in a subprocess, so it simply takes its place
+ * @return 127 if the utility cannot be run
+ */
+static int
+exec_utility (const char *cmd, int argc, char **argv)
+{
+    char **args = xcalloc (argc + 2, sizeof (char *));
+    int i;
+    args[0] = (char *) cmd;
+    for (i = 0; i < argc; i++)
+        args[i + 1] = argv[i];
+    fflush (stdout);
+    execvp (cmd, args);
+    fprintf (stderr, "%s: %s\n", cmd, strerror (errno));
+    xfree (args);
+    return 127;
+}
+
+/**
+ * Parse the line count of head and tail: -n N, -nN or -N (10 by default)
+ * @return The count, -1 if the arguments are something else
+ */
+static long
+line_count (int argc, char **argv)
+{
+    const char *v = NULL;
+    char *end;
+    long n;
+    if (argc == 0)
+        return 10;
+    if (argc == 2 && xstrcmp (argv[0], "-n") == 0)
+        v = argv[1];
+    else if (argc == 1 && strncmp (argv[0], "-n", 2) == 0)
+        v = argv[0] + 2;
+    else if (argc == 1 && argv[0][0] == '-')
+        v = argv[0] + 1;
+    if (v == NULL || *v < '0' || *v > '9')
+        return -1;
+    n = strtol (v, &end, 10);
+    return *end == '\0' ? n : -1;
+}
+
+int
+sd_wc (int argc, char **argv, int in, int out, int err)
+{
+    long n;
+    if (argc != 1 || xstrcmp (argv[0], "-l") != 0)
+        return exec_utility ("wc", argc, argv);
+    n = scan_lines (in);
+    if (n < 0)
+    {
+        fprintf (stderr, "wc: %s\n", strerror (errno));
+        return 1;
+    }
+    fprintf (stdout, "%ld\n", n);
+    (void) out;
+    (void) err;
+
+    return 0;
+}
+
+int
+sd_head (int argc, char **argv, int in, int out, int err)
+{
+    long n = line_count (argc, argv);
+    if (n < 0)
+        return exec_utility ("head", argc, argv);
+    if (scan_head (in, out, n) != 0)
+    {
+        fprintf (stderr, "head: %s\n", strerror (errno));
+        return 1;
+    }
+    (void) err;
+
+    return 0;
+}
+
+int
+sd_tail (int argc, char **argv, int in, int out, int err)
+{
+    long n = line_count (argc, argv);
+    if (n < 0)
+        return exec_utility ("tail", argc, argv);
+    if (scan_tail (in, out, n) != 0)
+    {
+        fprintf (stderr, "tail: %s\n", strerror (errno));
+        return 1;
+    }
+    (void) err;
+
+    return 0;
+}
+
+int
+sd_grep (int argc, char **argv, int in, int out, int err)
+{
+    const char *lit = NULL;
+    int ret;
+    if (argc == 2 && (xstrcmp (argv[0], "-F") == 0 ||
+                      xstrcmp (argv[0], "--fixed-strings") == 0))
+        lit = argv[1];
+    else if (argc == 3 && xstrcmp (argv[0], "-F") == 0 &&
+             xstrcmp (argv[1], "--") == 0)
+        lit = argv[2];
+    /* a newline separates several patterns */
+    if (lit == NULL || strchr (lit, '\n') != NULL)
+        return exec_utility ("grep", argc, argv);
+    ret = scan_grep (in, out, lit);
+    if (ret < 0)
+    {
+        fprintf (stderr, "grep: %s\n", strerror (errno));
+        return 2;
+    }
+    (void) err;
+
+    return ret;
+}
+
+/**
+ * Run the real utility for what a builtin running in the shell does not
+ * handle
+ * @return Its exit status, 127 if it cannot be run
+ */
+static int
+run_utility (const char *cmd, int argc, char **argv, int in, int out, int err)
+{
+    int status;
+    pid_t pid;
+    fflush (stdout);
+    fflush (stderr);
+    pid = fork ();
+    if (pid == 0)
+    {
+        if (in != STDIN_FILENO)
+            dup2 (in, STDIN_FILENO);
+        if (out != STDOUT_FILENO)
+            dup2 (out, STDOUT_FILENO);
+        if (err != STDERR_FILENO)
+            dup2 (err, STDERR_FILENO);
+        _exit (exec_utility (cmd, argc, argv));
+    }
+    if (pid < 0 || waitpid (pid, &status, 0) != pid)
+        return 127;
+    return exit_code (status);
+}
+
+int
+sd_cat (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0, i = 0, nb;
+    struct stat so;
+    open_filestream ();
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (xstrcmp (argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        /* unbuffered is all we do */
+        if (xstrcmp (argv[i], "-u") != 0)
+        {
+            ret = run_utility ("cat", argc, argv, in, out, err);
+            goto end;
+        }
+    }
+    if (fstat (out, &so) != 0)
+        so.st_ino = 0;
+    /* no file: the standard input */
+    nb = argc - i;
+    for (; (i < argc || nb == 0) && !interrupted; i++)
+    {
+        const char *name = i < argc ? argv[i] : "-";
+        struct stat si;
+        int fd = in;
+        if (xstrcmp (name, "-") != 0)
+            fd = open (name, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+        {
+            sd_printerr ("cat: %s: %s\n", name, strerror (errno));
+            ret = 1;
+            continue;
+        }
+        if (fstat (fd, &si) == 0 && S_ISREG(si.st_mode) && 
+            si.st_ino == so.st_ino && si.st_dev == so.st_dev)
+        {
+            sd_printerr ("cat: %s: input file is output file\n", name);
+            ret = 1;
+        }
+        else if (copy_fd (fd, out) != 0)
+        {
+            sd_printerr ("cat: %s: %s\n", name, strerror (errno));
+            ret = 1;
+        }
+        if (fd != in)
+            close (fd);
+        if (nb == 0)
+            break;
+    }
+
+end:
+    close_filestream ();
+
+    return ret;
+}
+
+/* Copy a file for cp, printing what went wrong */
+static int
+cp_file (const char *src, const char *dst, unsigned int force, FILE *fderr)
+{
+    struct stat ss, sd;
+    int in, out, ret = 0;
+    in = open (src, O_RDONLY|O_CLOEXEC);
+    if (in < 0 || fstat (in, &ss) != 0)
+    {
+        sd_printerr ("cp: cannot stat '%s': %s\n", src, strerror (errno));
+        if (in >= 0)
+            close (in);
+        return 1;
+    }
+    if (S_ISDIR(ss.st_mode))
+    {
+        sd_printerr ("cp: -r not specified; omitting directory '%s'\n", src);
+        close (in);
+        return 1;
+    }
+    if (stat (dst, &sd) == 0 && sd.st_ino == ss.st_ino &&
+        sd.st_dev == ss.st_dev)
+    {
+        sd_printerr ("cp: '%s' and '%s' are the same file\n", src, dst);
+        close (in);
+        return 1;
+    }
+    /* a new file gets the permissions of the source, less the umask */
+    out = open (dst, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, ss.st_mode & 07777);
+    if (out < 0 && force && unlink (dst) == 0)
+        out = open (dst, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+                    ss.st_mode & 07777);
+    if (out < 0)
+    {
+        sd_printerr ("cp: cannot create regular file '%s': %s\n", dst,
+                     strerror (errno));
+        close (in);
+        return 1;
+    }
+    if (copy_fd (in, out) != 0)
+    {
+        sd_printerr ("cp: error copying '%s' to '%s': %s\n", src, dst,
+                     strerror (errno));
+        ret = 1;
+    }
+    if (close (out) != 0 && ret == 0)
+    {
+        sd_printerr ("cp: failed to close '%s': %s\n", dst, strerror (errno));
+        ret = 1;
+    }
+    close (in);
+    return ret;
+}
+
+int
+sd_cp (int argc, char **argv, int in, int out, int err)
+{
+    int ret = 0, i = 0, nb;
+    unsigned int force = FALSE, todir;
+    struct stat st;
+    const char *target;
+    open_filestream ();
+
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (xstrcmp (argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        if (xstrcmp (argv[i], "-f") == 0)
+            force = TRUE;
+        else
+        {
+            /* -r, -a, -p...: the real cp */
+            ret = run_utility ("cp", argc, argv, in, out, err);
+            goto end;
+        }
+    }
+    nb = argc - i - 1;
+    if (nb < 1)
+    {
+        sd_printerr ("cp: missing %s operand\n", nb < 0 ? "file" :
+                                                          "destination file");
+        ret = 1;
+        goto end;
+    }
+    target = argv[argc - 1];
+    todir = stat (target, &st) == 0 && S_ISDIR(st.st_mode);
+    if (nb > 1 && !todir)
+    {
+        sd_printerr ("cp: target '%s' is not a directory\n", target);
+        ret = 1;
+        goto end;
+    }
+    for (; i < argc - 1 && !interrupted; i++)
+    {
+        char *dst = (char *) target;
+        if (todir)
+        {
+            const char *base = strrchr (argv[i], '/');
+            base = base != NULL ? base + 1 : argv[i];
+            dst = xmalloc (xstrlen (target) + xstrlen (base) + 2);
+            sprintf (dst, "%s/%s", target, base);
+        }
+        if (cp_file (argv[i], dst, force, fderr) != 0)
+            ret = 1;
+        if (dst != target)
+            xfree (dst);
+    }
+
+end:
+    close_filestream ();
+
+    return ret;
+}
@@ -158,4 +158,188 @@ int sd_echo (int argc, char **argv, int in, int out, int err);
  */
 int sd_exec (int argc, char **argv, int in, int out, int err);
 
+/**
+ * Builtin command to display or change the shell options
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_set (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command to copy its standard input to its standard output and to
+ * the given files. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_tee (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command to run a command unless it already ran with the same
+ * arguments, environment and inputs, in which case its outputs and exit status
+ * are replayed from a store. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_memo (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command to render the trace ring (cf. set -x) as text or in the
+ * Chrome trace format. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_trace (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command to rerun a command each time files change. It runs in a
+ * subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_onchange (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command to wait for the end of jobs. Without operand, it waits for
+ * them all and returns 0; otherwise, it returns the status of the last one
+ * listed (of the first one to end with -n)
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_wait (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command to send a signal to jobs (through their pidfd, so never to
+ * a process that took the pid of a job) or to processes
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_kill (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command adding a job started once other jobs ended
+ * (after %1 %2 -- cmd), or making a waiting job wait for more (after %1 -- %3)
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_after (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command like after, the job being cancelled unless the jobs it
+ * waits for all return 0
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_after_success (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command counting the lines of its input (wc -l). Other uses run the
+ * real wc. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_wc (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command printing the first lines of its input (head [-n N]). Other
+ * uses run the real head. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_head (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command printing the last lines of its input (tail [-n N]). Other
+ * uses run the real tail. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_tail (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command printing the lines of its input containing a string
+ * (grep -F string). Other uses run the real grep. It runs in a subprocess.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if a line matched, 1 if none did, 2 on error
+ */
+int sd_grep (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command copying files or its input to its output in the kernel
+ * (copy_file_range, sendfile or splice). Options other than -u run the real
+ * cat. It runs in the shell in foreground and in a subprocess in a pipe or in
+ * background.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_cat (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Builtin command copying files in the kernel (cp [-f] src... dst). Other
+ * options run the real cp. It runs in the shell in foreground and in a
+ * subprocess in a pipe or in background.
+ * @param argc Number of arguments passed to the command
+ * @param argv Array of strings containing the arguments passed to the command
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return 0 if the command succeed, non-zero if not
+ */
+int sd_cp (int argc, char **argv, int in, int out, int err);
+
 #endif
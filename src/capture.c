@@ -0,0 +1,280 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "capture.h"
+#include "evloop.h"
+#include "pipeline.h"
+#include "usage.h"
+#include "xutils.h"
+
+/* most bytes the ring gets at once */
+#define CAPTURE_CHUNK (64 * 1024)
+/* smallest ring accepted */
+#define CAPTURE_MIN (4 * 1024)
+/* ms between two looks at a ring while its job runs */
+#define CAPTURE_POLL 100
+
+/* Header of a ring, followed by the data */
+typedef struct {
+    /* nb bytes ever written: the last ones are at written % size */
+    unsigned long long written;
+    /* capacity of the ring */
+    unsigned long long size;
+} capture_header;
+
+/* Most bytes the writer copies before it updates the header */
+static unsigned long long
+chunk_of (unsigned long long size)
+{
+    return size / 4 < CAPTURE_CHUNK ? size / 4 : CAPTURE_CHUNK;
+}
+
+/* Oldest byte still in the ring, the writer may be overwriting the ones before */
+static unsigned long long
+oldest_of (const capture_header *h, unsigned long long written)
+{
+    unsigned long long keep = h->size - chunk_of (h->size);
+    return written > keep ? written - keep : 0;
+}
+
+static capture_header *
+map_ring (int ring, int prot, size_t *len)
+{
+    struct stat st;
+    void *p;
+    if (ring < 0 || fstat (ring, &st) != 0 ||
+        st.st_size <= (off_t) sizeof (capture_header))
+        return NULL;
+    p = mmap (NULL, st.st_size, prot, MAP_SHARED, ring, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    *len = st.st_size;
+    return p;
+}
+
+int
+capture_open (size_t size)
+{
+    capture_header h;
+    int fd;
+    if (size < CAPTURE_MIN)
+        size = CAPTURE_MIN;
+    fd = memfd_create ("shelldone-job", MFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    h.written = 0;
+    h.size = size;
+    /* the pages are only taken as the job writes */
+    if (ftruncate (fd, sizeof (h) + size) != 0 ||
+        pwrite (fd, &h, sizeof (h), 0) != (ssize_t) sizeof (h))
+    {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Copy everything read on 'in' to the ring, overwriting the oldest bytes */
+static int
+fill_ring (int in, int ring)
+{
+    size_t len;
+    capture_header *h = map_ring (ring, PROT_READ|PROT_WRITE, &len);
+    char *data, buf[CAPTURE_CHUNK];
+    ssize_t r;
+    if (h == NULL)
+        return -1;
+    data = (char *) (h + 1);
+    while ((r = read (in, buf, chunk_of (h->size))) != 0)
+    {
+        unsigned long long w = h->written;
+        size_t done = 0;
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        while (done < (size_t) r)
+        {
+            size_t o = (w + done) % h->size, n = r - done;
+            if (n > h->size - o)
+                n = h->size - o;
+            memcpy (data + o, buf + done, n);
+            done += n;
+        }
+        __atomic_store_n (&h->written, w + r, __ATOMIC_RELEASE);
+    }
+    munmap (h, len);
+    return r < 0 ? -1 : 0;
+}
+
+pid_t
+capture_start (int ring, int *out)
+{
+    int fd[2], keep[2];
+    pid_t r;
+    if (new_pipe (fd) == -1)
+        return -1;
+    keep[0] = fd[0];
+    keep[1] = ring;
+    /* make sure nothing buffered is written twice */
+    fflush (stdout);
+    fflush (stderr);
+    r = fork_helper (keep, 2);
+    if (r == 0)
+    {
+        /* the job may outlive a ^C, what it writes must still be kept */
+        signal (SIGINT, SIG_IGN);
+        _exit (fill_ring (fd[0], ring) == 0 ? 0 : 1);
+    }
+    close (fd[0]);
+    if (r == -1)
+    {
+        close (fd[1]);
+        return -1;
+    }
+    *out = fd[1];
+    return r;
+}
+
+/* Tell how many bytes were overwritten before anybody read them */
+static int
+print_lost (int out, unsigned long long lost)
+{
+    char buf[BUF];
+    int len;
+    if (lost == 0)
+        return 0;
+    len = snprintf (buf, sizeof (buf), "[... %llu bytes dropped ...]\n", lost);
+    return xwrite (out, buf, len);
+}
+
+int
+capture_print (int ring, int out, unsigned long long *pos)
+{
+    size_t len;
+    capture_header *h = map_ring (ring, PROT_READ, &len);
+    const char *data;
+    char buf[CAPTURE_CHUNK];
+    unsigned long long w, lost = 0;
+    int ret = 0;
+    if (h == NULL)
+        return -1;
+    data = (const char *) (h + 1);
+    w = __atomic_load_n (&h->written, __ATOMIC_ACQUIRE);
+    while (*pos < w && ret == 0)
+    {
+        size_t o, n;
+        if (*pos < oldest_of (h, w))
+        {
+            lost += oldest_of (h, w) - *pos;
+            *pos = oldest_of (h, w);
+            continue;
+        }
+        o = *pos % h->size;
+        n = w - *pos < sizeof (buf) ? w - *pos : sizeof (buf);
+        if (n > h->size - o)
+            n = h->size - o;
+        memcpy (buf, data + o, n);
+        /* the copy is only good if the writer did not get there meanwhile */
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        w = __atomic_load_n (&h->written, __ATOMIC_RELAXED);
+        if (*pos < oldest_of (h, w))
+            continue;
+        if (print_lost (out, lost) < 0 || xwrite (out, buf, n) < 0)
+            ret = -1;
+        lost = 0;
+        *pos += n;
+    }
+    if (ret == 0 && print_lost (out, lost) < 0)
+        ret = -1;
+    munmap (h, len);
+    return ret;
+}
+
+pid_t
+capture_wait (const command *ptr, int *status, int out,
+              unsigned long long *pos)
+{
+    pid_t r;
+    /* 
+     * nothing is added to the loop: ^Z leaves this wait through a long jump
+     * (cf. sigstophandler)
+     */
+    while ((r = waitpid (ptr->pid, status, WNOHANG)) == 0)
+    {
+        capture_print (ptr->capture, out, pos);
+        evloop_wait (CAPTURE_POLL);
+    }
+    return r;
+}
+
+unsigned int
+format_capture (int ring, char *buf, size_t len)
+{
+    size_t l;
+    capture_header *h = map_ring (ring, PROT_READ, &l);
+    struct stat st;
+    unsigned long long w;
+    char held[32], size[32], mem[32], lost[32];
+    if (h == NULL)
+        return FALSE;
+    w = __atomic_load_n (&h->written, __ATOMIC_ACQUIRE);
+    format_size (w < h->size ? w : h->size, held, sizeof (held));
+    format_size (h->size, size, sizeof (size));
+    format_size (w > h->size ? w - h->size : 0, lost, sizeof (lost));
+    /* what the ring really takes: its pages are allocated as it fills */
+    if (fstat (ring, &st) == 0)
+        format_size (st.st_blocks * 512L, mem, sizeof (mem));
+    else
+        snprintf (mem, sizeof (mem), "?");
+    snprintf (buf, len, " held=%s size=%s mem=%s dropped=%s",
+              held, size, mem, lost);
+    munmap (h, l);
+    return TRUE;
+}
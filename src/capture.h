@@ -0,0 +1,90 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "structs.h"
+
+/**
+ * Create the ring keeping the output of a background job: an anonymous file
+ * in memory (memfd) holding the last 'size' bytes written to it
+ * @param size Capacity of the ring (cf. jobs.capture.size)
+ * @return The descriptor of the ring, -1 on error
+ */
+int capture_open (size_t size);
+
+/**
+ * Fork a process filling a ring with everything written to a pipe
+ * @param ring Descriptor of the ring (cf. capture_open)
+ * @param out Receives the write end of the pipe, given to the job
+ * @return The pid of the process, -1 on error
+ */
+pid_t capture_start (int ring, int *out);
+
+/**
+ * Write what a ring got since a position. When the ring wrapped around in the
+ * meantime, a line tells how many bytes were lost
+ * @param ring Descriptor of the ring
+ * @param out Descriptor to write to
+ * @param pos Nb bytes of the ring already written, updated
+ * @return 0 on success, -1 on error
+ */
+int capture_print (int ring, int out, unsigned long long *pos);
+
+/**
+ * Write what the ring of a command gets until the command changes state, then
+ * wait for it. The event loop is served meanwhile
+ * @param ptr The command
+ * @param status Receives its status, like waitpid
+ * @param out Descriptor to write to
+ * @param pos Nb bytes of the ring already written, updated
+ * @return Same as waitpid
+ */
+pid_t capture_wait (const command *ptr, int *status, int out,
+                    unsigned long long *pos);
+
+/**
+ * Describe the memory a ring takes (ie. " held=12.0K size=1.0M mem=16.0K
+ * dropped=0.0K")
+ * @param ring Descriptor of the ring
+ * @param buf Buffer receiving the description
+ * @param len Size of the buffer (BUF is enough)
+ * @return FALSE if there is no ring
+ */
+unsigned int format_capture (int ring, char *buf, size_t len);
+
+#endif
@@ -48,6 +48,7 @@
 #include <signal.h>
 #include <string.h>
 #include <setjmp.h>
+#include <sys/syscall.h>
 
 #include "builtin.h"
 #include "command.h"
@@ -55,6 +56,14 @@
 #include "xutils.h"
 #include "jobs.h"
 #include "modules.h"
+#include "options.h"
+#include "pipeline.h"
+#include "relay.h"
+#include "capture.h"
+#include "trace.h"
+#include "rlimits.h"
+#include "meter.h"
+#include "usage.h"
 
 static const builtin calls[] = {{"cd", (cmd_builtin) sd_cd},
                                 {"bg", (cmd_builtin) sd_bg},
@@ -65,9 +74,34 @@ static const builtin calls[] = {{"cd", (cmd_builtin) sd_cd},
                                 {"jobs", (cmd_builtin) sd_jobs},
                                 {"module", (cmd_builtin) sd_module},
                                 {"rehash", (cmd_builtin) sd_rehash},
+                                {"set", (cmd_builtin) sd_set},
+                                {"wait", (cmd_builtin) sd_wait},
+                                {"kill", (cmd_builtin) sd_kill},
+                                {"after", (cmd_builtin) sd_after},
+                                {"after-success",
+                                 (cmd_builtin) sd_after_success},
 /*                              {"echo", (cmd_builtin) sd_echo}, */
                                 {NULL, NULL}};
 
+/* 
+ * builtins that run in the shell when it waits for them anyway and in a
+ * subprocess in a pipe or in background, where they must not hold the shell
+ */
+static const builtin light_calls[] = {{"cat", (cmd_builtin) sd_cat},
+                                      {"cp", (cmd_builtin) sd_cp},
+                                      {NULL, NULL}};
+
+/* builtins that run in a subprocess like any other command */
+static const builtin forked_calls[] = {{"tee", (cmd_builtin) sd_tee},
+                                       {"memo", (cmd_builtin) sd_memo},
+                                       {"trace", (cmd_builtin) sd_trace},
+                                       {"onchange", (cmd_builtin) sd_onchange},
+                                       {"wc", (cmd_builtin) sd_wc},
+                                       {"head", (cmd_builtin) sd_head},
+                                       {"tail", (cmd_builtin) sd_tail},
+                                       {"grep", (cmd_builtin) sd_grep},
+                                       {NULL, NULL}};
+
 extern pid_t shell_pgid;
 extern int shell_is_interactive;
 extern int shell_terminal;
@@ -77,6 +111,10 @@ extern int val;
 
 command *curr = NULL;
 int ret_code;
+/* the line being run is the last thing the shell will do (ie. -c) */
+unsigned int last_line = FALSE;
+/* command allowed to replace the shell instead of being forked */
+static command_line *in_place = NULL;
 
 void
 sigstophandler (int sig)
@@ -101,6 +139,7 @@ new_command (void)
     command *ret = xmalloc (sizeof (*ret));
     if (ret != NULL)
     {
+        ret->refs = 1;
         ret->cmd = NULL;
         ret->argv = NULL;
         ret->protected = NULL;
@@ -115,7 +154,19 @@ new_command (void)
         ret->stopped = FALSE;
         ret->continued = FALSE;
         ret->pid = -1;
+        ret->pidfd = -1;
         ret->job = -1;
+        ret->shards = 1;
+        ret->cpu = -1;
+        ret->outs = NULL;
+        ret->nb_outs = 0;
+        ret->errs = NULL;
+        ret->nb_errs = 0;
+        ret->relay_out = -1;
+        ret->relay_err = -1;
+        ret->capture = -1;
+        init_limits (&ret->lim);
+        ret->start = 0;
     }
     return ret;
 }
@@ -150,7 +201,32 @@ copy_command (const command *src)
     ret->stopped = src->stopped;
     ret->continued = src->continued;
     ret->pid = src->pid;
+    ret->pidfd = src->pidfd >= 0 ?
+                    fcntl (src->pidfd, F_DUPFD_CLOEXEC, 0) :
+                    -1;
     ret->job = src->job;
+    ret->shards = src->shards;
+    ret->cpu = src->cpu;
+    /* the relays are children of the original, which waits for them */
+    ret->relay_out = -1;
+    ret->relay_err = -1;
+    ret->capture = src->capture >= 0 ?
+                    fcntl (src->capture, F_DUPFD_CLOEXEC, 0) :
+                    -1;
+    ret->lim = src->lim;
+    ret->start = src->start;
+    if (src->nb_outs > 0)
+    {
+        ret->outs = xcalloc (src->nb_outs, sizeof (int));
+        memcpy (ret->outs, src->outs, src->nb_outs * sizeof (int));
+        ret->nb_outs = src->nb_outs;
+    }
+    if (src->nb_errs > 0)
+    {
+        ret->errs = xcalloc (src->nb_errs, sizeof (int));
+        memcpy (ret->errs, src->errs, src->nb_errs * sizeof (int));
+        ret->nb_errs = src->nb_errs;
+    }
     if (src->argc > 0)
     {
         ret->argv = xcalloc (src->argc, sizeof (char *));
@@ -206,6 +282,27 @@ copy_cmd_line (const command_line *src)
     return ret;
 }
 
+command *
+ref_command (command *ptr)
+{
+    if (ptr != NULL)
+        ptr->refs++;
+    return ptr;
+}
+
+command *
+own_command (command *ptr)
+{
+    command *ret;
+    if (ptr == NULL || ptr->refs == 1)
+        return ptr;
+    ret = copy_command (ptr);
+    if (ret == NULL)
+        return ptr;
+    free_command (ptr);
+    return ret;
+}
+
 int
 compare_command (command *c1, command *c2)
 {
@@ -231,6 +328,9 @@ compare_command (command *c1, command *c2)
 void
 free_command (command *ptr)
 {
+    /* still held by the line, the job list or fg */
+    if (ptr != NULL && --ptr->refs > 0)
+        return;
     if (ptr != NULL)
     {
         int cpt;
@@ -253,7 +353,13 @@ free_command (command *ptr)
         ptr->argv = NULL;
         ptr->argvf = NULL;
         xfree (ptr->protected);
+        xfree (ptr->outs);
+        xfree (ptr->errs);
         xfree (ptr->cmd);
+        if (ptr->pidfd >= 0)
+            close (ptr->pidfd);
+        if (ptr->capture >= 0)
+            close (ptr->capture);
         xfree (ptr);
         ptr = NULL;
     }
@@ -374,6 +480,249 @@ check_wildcard_match (const char *text, const char *pattern)
     return TRUE;
 }
 
+static cmd_builtin
+get_builtin (const builtin *table, const char *name)
+{
+    int i = 0;
+    while (table[i].key != NULL)
+    {
+        if (xstrcmp (name, table[i].key) == 0)
+            return table[i].func;
+        i++;
+    }
+    return NULL;
+}
+
+/**
+ * Make an output of a command go through a relay copying it to the extra
+ * targets of the output (ie. cmd >a >b)
+ * @param out Output of the command, replaced by the input of the relay
+ * @param more Extra targets of the output, closed once given to the relay
+ * @param nb Number of extra targets
+ * @return The pid of the relay, -1 if none
+ */
+static pid_t
+start_fanout (int *out, int *more, int nb)
+{
+    int fd[2], i, *targets;
+    pid_t r;
+    if (nb == 0 || new_pipe (fd) == -1)
+        return -1;
+    targets = xcalloc (nb + 1, sizeof (int));
+    targets[0] = *out;
+    memcpy (targets + 1, more, nb * sizeof (int));
+    /* make sure nothing buffered is written twice */
+    fflush (stdout);
+    fflush (stderr);
+    r = relay_start (fd[0], targets, nb + 1);
+    close (fd[0]);
+    for (i = 0; i < nb; i++)
+        close (more[i]);
+    xfree (targets);
+    if (r == -1)
+    {
+        close (fd[1]);
+        return -1;
+    }
+    *out = fd[1];
+    return r;
+}
+
+/**
+ * Make a background command write to a ring instead of the terminal (cf.
+ * jobs.capture), its errors included unless they were redirected
+ * @param ptr Command about to run, its outputs are replaced by the input of
+ * the process filling the ring
+ */
+static void
+start_capture (command *ptr)
+{
+    int ring = capture_open (get_option_int ("jobs.capture.size")), fd, e;
+    pid_t r;
+    if (ring == -1)
+    {
+        warn ("capture");
+        return;
+    }
+    r = capture_start (ring, &fd);
+    if (r == -1)
+    {
+        warn ("capture");
+        close (ring);
+        return;
+    }
+    if (ptr->capture >= 0)
+        close (ptr->capture);
+    ptr->capture = ring;
+    ptr->relay_out = r;
+    ptr->out = fd;
+    if (ptr->err == STDERR_FILENO &&
+        (e = fcntl (fd, F_DUPFD_CLOEXEC, 0)) >= 0)
+        ptr->err = e;
+}
+
+/* Room execve(2) leaves for the arguments and the environment */
+static size_t
+arg_limit (void)
+{
+    long max = sysconf (_SC_ARG_MAX);
+    if (max <= 0)
+        max = 128 * 1024;
+    /* keep some headroom like xargs does */
+    return max - 4096;
+}
+
+/* Room taken by a string passed to execve(2) */
+static size_t
+arg_size (const char *str)
+{
+    return xstrlen (str) + 1 + sizeof (char *);
+}
+
+/* Room the environment and the arguments of a command take on exec */
+static size_t
+exec_size (const command *ptr)
+{
+    size_t size = arg_size (ptr->cmd) + sizeof (char *);
+    char **env;
+    int i;
+    for (env = environ; env != NULL && *env != NULL; env++)
+        size += arg_size (*env);
+    for (i = 0; i < ptr->argcf; i++)
+        size += arg_size (ptr->argvf[i]);
+    return size;
+}
+
+/* Check if the parsing plugins expand the given word (cf. wildcards) */
+static unsigned int
+is_expanded (const command *ptr, int i)
+{
+    return (ptr->protected[i] == NONE &&
+            strpbrk (ptr->argv[i], "*?[]$`") != NULL) ||
+           (ptr->protected[i] != SINGLE_QUOTE &&
+            strpbrk (ptr->argv[i], "$`") != NULL);
+}
+
+/**
+ * Check if the arguments of a command can be split in batches: only leading
+ * options may come with each batch, and everything after them must be
+ * expanded lists. Otherwise an operand before the list (ie. 'grep pat *.log')
+ * or a destination after it (ie. 'cp *.log dir/') would not be where the
+ * command expects it in every batch
+ * @param ptr Command to check
+ * @return The number of leading options, -1 if the command cannot be batched
+ */
+static int
+batch_prefix (const command *ptr)
+{
+    int prefix = 0, i;
+    while (prefix < ptr->argc && ptr->argv[prefix][0] == '-')
+    {
+        if (is_expanded (ptr, prefix))
+            return -1;
+        prefix++;
+    }
+    if (prefix == ptr->argc)
+        return -1;
+    for (i = prefix; i < ptr->argc; i++)
+        if (!is_expanded (ptr, i))
+            return -1;
+    return prefix;
+}
+
+/**
+ * Execute a command whose arguments do not fit in one exec, in batches that
+ * fit (cf. the 'batch' option). The leading options (ie. 'rm -f') are given
+ * to every batch and up to 'batch.jobs' batches run at the same time
+ * @param ptr Command to execute
+ * @param argv Arguments of the command (command included)
+ * @param argc Number of arguments
+ * @param prefix Number of leading options (cf. batch_prefix)
+ * @return The highest exit status of the batches
+ */
+static int
+run_batches (const command *ptr, char **argv, int argc, int prefix)
+{
+    size_t limit = arg_limit (), base = exec_size (ptr);
+    int jobs = xmax (get_option_int ("batch.jobs"), 1), running = 0, ret = 0;
+    int i, status;
+    char **batch = xcalloc (argc + 1, sizeof (char *));
+    /* the batches running, the oldest one first */
+    pid_t *pids = xcalloc (jobs, sizeof (pid_t));
+    /* the command itself comes first */
+    prefix++;
+    memcpy (batch, argv, prefix * sizeof (char *));
+    /* from now on, base is the room taken by everything but the batch */
+    for (i = prefix; i < argc; i++)
+        base -= arg_size (argv[i]);
+    i = prefix;
+    while (i < argc || running > 0)
+    {
+        pid_t p;
+        if (i < argc && running < jobs)
+        {
+            size_t size = base;
+            int n = prefix;
+            while (i < argc && (n == prefix || 
+                                size + arg_size (argv[i]) <= limit))
+            {
+                size += arg_size (argv[i]);
+                batch[n++] = argv[i++];
+            }
+            batch[n] = NULL;
+            if ((p = fork ()) == 0)
+            {
+                execvp (batch[0], batch);
+                err (1, "%s", batch[0]);
+            }
+            if (p > 0)
+            {
+                pids[running++] = p;
+                continue;
+            }
+            ret = xmax (ret, 254);
+            i = argc;
+        }
+        /* the oldest batch is the most likely to end first */
+        if (waitpid (pids[0], &status, 0) == -1)
+            break;
+        memmove (pids, pids + 1, --running * sizeof (pid_t));
+        if (WIFEXITED(status))
+            ret = xmax (ret, WEXITSTATUS(status));
+        else if (WIFSIGNALED(status))
+            ret = xmax (ret, 128 + WTERMSIG(status));
+    }
+    xfree (pids);
+    xfree (batch);
+    return ret;
+}
+
+void
+wait_relays (command *ptr)
+{
+    if (ptr == NULL)
+        return;
+    if (ptr->relay_out > 0)
+        waitpid (ptr->relay_out, NULL, 0);
+    if (ptr->relay_err > 0)
+        waitpid (ptr->relay_err, NULL, 0);
+    ptr->relay_out = -1;
+    ptr->relay_err = -1;
+}
+
+/**
+ * Check if a command may be exec'd in place of the shell: nothing can come
+ * after it and nobody needs the shell to wait for it
+ * @param ptrc Command about to run
+ * @return TRUE or FALSE
+ */
+static unsigned int
+is_final (const command_line *ptrc)
+{
+    return last_line && ptrc->next == NULL && ptrc->content->flag == END &&
+           get_last_job () == NULL && trace_path () == NULL;
+}
+
 pid_t
 run_command (command_line *ptrc)
 {
@@ -396,6 +745,7 @@ run_command (command_line *ptrc)
     }
     curr = ptr;
     pid_t r = -1;
+    trace_ref args = trace_expand (ptr);
     if (ptr != NULL)
     {
         size_t len = xstrlen (ptr->cmd);
@@ -412,17 +762,28 @@ run_command (command_line *ptrc)
                 return 0;
             }
         }
-        cmd_builtin call = NULL;
-        int i = 0;
-        while (calls[i].key != NULL)
-        {
-            if (xstrcmp (ptr->cmd, calls[i].key) == 0)
-            {
-                call = calls[i].func;
-                break;
-            }
-            i++;
-        }
+        cmd_builtin call = get_builtin (calls, ptr->cmd);
+        cmd_builtin forked = get_builtin (forked_calls, ptr->cmd);
+        cmd_builtin light = get_builtin (light_calls, ptr->cmd);
+        int i, out = ptr->out, error = ptr->err;
+        /* 
+         * the extra targets are served by relays: the command only sees one
+         * output like any other
+         */
+        if (ptr->nb_outs > 0 && ptr->out != STDERR_FILENO)
+            ptr->relay_out = start_fanout (&ptr->out, ptr->outs, ptr->nb_outs);
+        if (ptr->nb_errs > 0 && ptr->err != STDOUT_FILENO)
+            ptr->relay_err = start_fanout (&ptr->err, ptr->errs, ptr->nb_errs);
+        ptr->nb_outs = 0;
+        ptr->nb_errs = 0;
+        if (light != NULL && (ptr->flag == PIPE || ptr->flag == BG))
+            forked = light;
+        else if (light != NULL)
+            call = light;
+        /* the terminal is left to the prompt and to the foreground */
+        if (call == NULL && ptr->flag == BG && ptr->out == STDOUT_FILENO &&
+            option_is ("jobs.capture", "on") && isatty (STDOUT_FILENO))
+            start_capture (ptr);
         if (call != NULL)
         {
             /**
@@ -439,8 +800,25 @@ run_command (command_line *ptrc)
         }
         else
         {
+            /* better know it before forking than fail on E2BIG */
+            int prefix = -1;
+            unsigned int batched = forked == NULL && 
+                                   option_is ("batch", "on") &&
+                                   exec_size (ptr) > arg_limit ();
+            if (batched && (prefix = batch_prefix (ptr)) < 0)
+            {
+                fprintf (stderr, "shelldone: %s: cannot batch arguments "
+                         "around an expanded list\n", ptr->cmd);
+                batched = FALSE;
+            }
+            /* the relays and the batches still need a parent */
+            unsigned int replace = ptrc == in_place && forked == NULL &&
+                                   !batched && ptr->relay_out <= 0 &&
+                                   ptr->relay_err <= 0;
             signal (SIGTSTP, sigstophandler);
-            r = fork ();
+            if (forked != NULL || replace)
+                fflush (NULL);
+            r = replace ? 0 : fork ();
             if (r == 0)
             {
                 pid_t pid, pgid;
@@ -481,6 +859,9 @@ run_command (command_line *ptrc)
                 signal (SIGTSTP, sighandler);
                 signal (SIGSTOP, sighandler);
                 */
+                if (ptr->cpu >= 0)
+                    pin_cpu (0, ptr->cpu);
+                apply_limits (&ptr->lim);
                 if (ptr->in != STDIN_FILENO)
                 {
                     dup2 (ptr->in, STDIN_FILENO);
@@ -499,6 +880,20 @@ run_command (command_line *ptrc)
                     else
                         dup2 (ptr->err, STDERR_FILENO);
                 }
+                trace_command (TRACE_EXEC, getpid (), args);
+                /* no exec will close the other pipes of the line for us */
+                if (forked != NULL || batched)
+                    detach_child (NULL, 0);
+                if (forked != NULL)
+                {
+                    signal (SIGINT, SIG_DFL);
+                    signal (SIGCHLD, SIG_DFL);
+                    i = forked (ptr->argcf, ptr->argvf, STDIN_FILENO, 
+                                STDOUT_FILENO, STDERR_FILENO);
+                    fflush (stdout);
+                    fflush (stderr);
+                    _exit (i);
+                }
                 /* Here we add the argv[0] which is the program name */
                 char ** argv;
                 if (ptr->argcf > 0)
@@ -524,16 +919,194 @@ run_command (command_line *ptrc)
                 }
                 else
                     argv = (char *[]){ptr->cmd, NULL};
+                if (batched)
+                    _exit (run_batches (ptr, argv, ptr->argcf + 1, prefix));
                 execvp (ptr->cmd, argv);
                 if (ptr->argcf > 0)
                     xfree (argv);
                 err (1, "%s", ptr->cmd);
             }
+            ptr->start = usage_clock ();
+            /* the child cannot be reaped before: its pid is still its own */
+            if (r > 0)
+            {
+                if (ptr->pidfd >= 0)
+                    close (ptr->pidfd);
+                ptr->pidfd = syscall (SYS_pidfd_open, r, 0);
+            }
+            trace_command (TRACE_SPAWN, r, args);
+        }
+        /* only the command and its relays keep the relay inputs open */
+        if (ptr->out != out)
+        {
+            close (ptr->out);
+            ptr->out = out;
         }
+        if (ptr->err != error)
+        {
+            close (ptr->err);
+            ptr->err = error;
+        }
+        if (ptr->builtin)
+            wait_relays (ptr);
     }
     return r;
 }
 
+pid_t
+start_job (command *ptr)
+{
+    command_line cl;
+    command *save = curr;
+    /* the shell may be at the prompt, where ^Z does nothing */
+    void (*stop) (int) = signal (SIGTSTP, SIG_IGN);
+    pid_t r;
+    int i;
+    /* run_command expands the arguments again */
+    if (ptr->argvf != ptr->argv)
+    {
+        for (i = 0; i < ptr->argcf; i++)
+            xfree (ptr->argvf[i]);
+        xfree (ptr->argvf);
+    }
+    ptr->argvf = NULL;
+    ptr->argcf = 0;
+    ptr->flag = BG;
+    cl.content = ptr;
+    cl.next = NULL;
+    cl.prev = NULL;
+    r = run_command (&cl);
+    signal (SIGTSTP, stop);
+    curr = save;
+    /* the redirections were kept open for the job alone */
+    if (ptr->in != STDIN_FILENO)
+        close (ptr->in);
+    if (ptr->out != STDOUT_FILENO && ptr->out != STDERR_FILENO)
+        close (ptr->out);
+    if (ptr->err != STDERR_FILENO && ptr->err != STDOUT_FILENO)
+        close (ptr->err);
+    return r;
+}
+
+void
+set_argv (command *ptr, int argc, char **argv)
+{
+    int i;
+    ptr->cmd = xstrdup (argv[0]);
+    ptr->argc = argc - 1;
+    if (ptr->argc > 0)
+    {
+        ptr->argv = xcalloc (ptr->argc, sizeof (char *));
+        ptr->protected = xcalloc (ptr->argc, sizeof (Protection));
+        /* the arguments were already expanded */
+        for (i = 0; i < ptr->argc; i++)
+        {
+            ptr->argv[i] = xstrdup (argv[i + 1]);
+            ptr->protected[i] = SINGLE_QUOTE;
+        }
+    }
+}
+
+command_line *
+run_argv (int argc, char **argv, int in, int out, int err)
+{
+    command_line *cl = new_cmd_line ();
+    command *ptr = cl->content, *save = curr;
+    set_argv (ptr, argc, argv);
+    ptr->in = in;
+    /* a builtin would close the descriptors of the caller */
+    ptr->out = dup (out);
+    ptr->err = dup (err);
+    ptr->pid = run_command (cl);
+    close (ptr->out);
+    close (ptr->err);
+    ptr->out = out;
+    ptr->err = err;
+    /* the caller is not the shell: ^Z must stop it */
+    signal (SIGTSTP, SIG_DFL);
+    curr = save;
+    return cl;
+}
+
+/**
+ * Run the copies of a sharded command (cf. the '|N>' operator) between a
+ * process splitting its input and another one merging their outputs
+ * @param ptrc Command to run
+ * @param pids Array receiving the pids of the processes launched
+ * @param cpus CPUs to pin the processes on, or NULL
+ * @return The number of processes launched
+ */
+static int
+run_shards (command_line *ptrc, pid_t *pids, const int *cpus)
+{
+    command *ptr = ptrc->content;
+    int nb = ptr->shards, in = ptr->in, out = ptr->out, error = ptr->err;
+    int merged = out, i, n = 0, fd[2];
+    int *to = xcalloc (nb, sizeof (int)), *from = xcalloc (nb, sizeof (int));
+    command_line **copies = xcalloc (nb, sizeof (command_line *));
+    ShardSplit mode = option_is ("shard.split", "hash") ? SHARD_HASH : SHARD_RR;
+    /* the copies share the relays of the whole stage (ie. cmd |4> grep >a >b) */
+    if (ptr->nb_outs > 0 && out != STDERR_FILENO)
+        ptr->relay_out = start_fanout (&merged, ptr->outs, ptr->nb_outs);
+    if (ptr->nb_errs > 0 && error != STDOUT_FILENO)
+        ptr->relay_err = start_fanout (&ptr->err, ptr->errs, ptr->nb_errs);
+    ptr->nb_outs = 0;
+    ptr->nb_errs = 0;
+    /* copy the command before the parsing plugins modify it */
+    copies[0] = ptrc;
+    for (i = 1; i < nb; i++)
+        copies[i] = copy_cmd_line (ptrc);
+    for (i = 0; i < nb; i++)
+    {
+        if (new_pipe (fd) == -1)
+            err (1, "pipe");
+        to[i] = fd[1];
+        copies[i]->content->in = fd[0];
+    }
+    pids[n] = shard_split (in, to, nb, mode, get_option_int ("shard.key"));
+    if (cpus != NULL)
+        pin_cpu (pids[n], cpus[n]);
+    n++;
+    for (i = 0; i < nb; i++)
+    {
+        close (to[i]);
+        if (new_pipe (fd) == -1)
+            err (1, "pipe");
+        from[i] = fd[0];
+        copies[i]->content->out = fd[1];
+        copies[i]->content->cpu = cpus != NULL ? cpus[n] : -1;
+        pids[n++] = run_command (copies[i]);
+        close (copies[i]->content->in);
+        close (copies[i]->content->out);
+    }
+    pids[n] = shard_merge (from, nb, merged, option_is ("shard.merge",
+                                                      "grouped"));
+    if (cpus != NULL)
+        pin_cpu (pids[n], cpus[n]);
+    n++;
+    for (i = 0; i < nb; i++)
+    {
+        close (from[i]);
+        if (i > 0)
+            free_cmd_line (copies[i]);
+    }
+    if (merged != out)
+        close (merged);
+    if (error != ptr->err)
+    {
+        close (ptr->err);
+        ptr->err = error;
+    }
+    ptr->in = in;
+    ptr->out = out;
+    ptr->pid = pids[1];
+    curr = ptr;
+    xfree (copies);
+    xfree (to);
+    xfree (from);
+    return n;
+}
+
 void
 run_line (input_line *ptr)
 {
@@ -544,6 +1117,9 @@ run_line (input_line *ptr)
         command_line *cmd = ptr->head;
         while (cmd != NULL)
         {
+            /* the queued jobs take the slots freed meanwhile */
+            if (nb_queued_jobs () > 0)
+                reap_jobs (FALSE);
             switch (cmd->content->flag)
             {
             /* 
@@ -554,7 +1130,18 @@ run_line (input_line *ptr)
             case BG:
             case END:
             {
-                pid_t p = run_command (cmd);
+                pid_t p;
+                /* over jobs.max, it waits for a slot (not in-shell builtins) */
+                if (cmd->content->flag == BG && !job_slot_free () &&
+                    get_builtin (calls, cmd->content->cmd) == NULL)
+                {
+                    queue_job (cmd->content);
+                    ret_code = 0;
+                    break;
+                }
+                if (is_final (cmd))
+                    in_place = cmd;
+                p = run_command (cmd);
                 cmd->content->pid = p;
                 /* p should never be equal to -1 */
                 if (p != -1 && !cmd->content->builtin)
@@ -566,8 +1153,13 @@ run_line (input_line *ptr)
                     }
                     else
                     {
-                        waitpid (p, &ret, WUNTRACED);
+                        wait_foreground (p, &ret, WUNTRACED);
                         ret_code = WEXITSTATUS(ret);
+                        if (!WIFSTOPPED(ret))
+                        {
+                            trace_exit (p, ret);
+                            wait_relays (cmd->content);
+                        }
                     }
                 }
                 else if (p == -1)
@@ -595,8 +1187,13 @@ run_line (input_line *ptr)
                 exec->content->pid = p;
                 if (p != -1 && !exec->content->builtin)
                 {
-                    waitpid (p, &ret, WUNTRACED);
+                    wait_foreground (p, &ret, WUNTRACED);
                     ret_code = WEXITSTATUS(ret);
+                    if (!WIFSTOPPED(ret))
+                    {
+                        trace_exit (p, ret);
+                        wait_relays (exec->content);
+                    }
                 }
                 else if (p == -1)
                     ret_code = 254;
@@ -606,12 +1203,19 @@ run_line (input_line *ptr)
                                         (ret_code == 0) : 
                                         (ret_code != 0)))
                 {
+                    if (is_final (exec))
+                        in_place = exec;
                     p = run_command (exec);
                     exec->content->pid = p;
                     if (p != -1 && !exec->content->builtin)
                     {
-                        waitpid (p, &ret, WUNTRACED);
+                        wait_foreground (p, &ret, WUNTRACED);
                         ret_code = WEXITSTATUS(ret);
+                        if (!WIFSTOPPED(ret))
+                        {
+                            trace_exit (p, ret);
+                            wait_relays (exec->content);
+                        }
                     }
                     else if (p == -1)
                         ret_code = 254;
@@ -623,26 +1227,72 @@ run_line (input_line *ptr)
             }
             case PIPE:
             {
-                int nb = 1, i, fd[2];
-                pid_t *p;
+                int nb = 1, tot = 0, i, k, m = 0, fd[2], *cpus;
+                pid_t *p, *meters = NULL;
                 unsigned int *builtins;
+                meter_stats *stats = NULL;
                 command_line *exec = cmd, *save = cmd;
                 while (exec != NULL && exec->content->flag == PIPE)
                 {
                     nb++;
                     exec = exec->next;
                 }
-                p = xmalloc (nb * sizeof (pid_t));
-                builtins = xmalloc (nb * sizeof (unsigned int));
+                /* a sharded command also needs a splitter and a merger */
+                for (exec = cmd, i = 0; i < nb && exec != NULL; i++)
+                {
+                    tot += exec->content->shards > 1 ?
+                                exec->content->shards + 2 :
+                                1;
+                    exec = exec->next;
+                }
+                nb = i;
+                /* pipe.stats: a meter sits on each pipe of the line */
+                if (nb > 1 && option_is ("pipe.stats", "on") &&
+                    (stats = meter_alloc (nb - 1)) != NULL)
+                    meters = xcalloc (nb - 1, sizeof (pid_t));
+                p = xmalloc (tot * sizeof (pid_t));
+                builtins = xcalloc (tot, sizeof (unsigned int));
+                cpus = pipeline_cpus (tot);
                 exec = cmd;
-                for (i = 0; i < nb; i++)
+                for (i = 0, k = 0; i < nb; i++)
                 {
-                    pipe (fd);
+                    /* 
+                     * the descriptors must not leak into the other commands
+                     * or the readers would never see the end of their input
+                     */
                     if (i != nb - 1)
+                    {
+                        if (new_pipe (fd) == -1)
+                            err (1, "pipe");
                         exec->content->out = fd[1];
-                    p[i] = run_command (exec);
-                    builtins[i] = exec->content->builtin;
-                    exec->content->pid = p[i];
+                        if (stats != NULL)
+                        {
+                            int to[2];
+                            if (new_pipe (to) == -1)
+                                err (1, "pipe");
+                            meters[m] = meter_start (fd[0], to[1], &stats[m]);
+                            m++;
+                            close (fd[0]);
+                            close (to[1]);
+                            fd[0] = to[0];
+                        }
+                    }
+                    if (exec->content->shards > 1 && 
+                        get_builtin (calls, exec->content->cmd) == NULL)
+                    {
+                        k += run_shards (exec, p + k,
+                                         cpus != NULL ? cpus + k : NULL);
+                    }
+                    else
+                    {
+                        exec->content->cpu = cpus != NULL ? cpus[k] : -1;
+                        p[k] = run_command (exec);
+                        builtins[k] = exec->content->builtin;
+                        exec->content->pid = p[k];
+                        k++;
+                    }
+                    if (i > 0)
+                        close (exec->content->in);
                     if (exec->content->out != STDOUT_FILENO && 
                         exec->content->out != STDERR_FILENO)
                         close (exec->content->out);
@@ -651,21 +1301,44 @@ run_line (input_line *ptr)
                         close (exec->content->err);
                     save = exec;
                     exec = exec->next;
-                    if (exec != NULL)
+                    if (exec != NULL && i != nb - 1)
                         exec->content->in = fd[0];
                 }
+                nb = k;
                 for (i = 0; i < nb; i++)
                 {
                     if (p[i] != -1 && !builtins[i])
                     {
-                        waitpid (p[i], &ret, WUNTRACED);
+                        wait_foreground (p[i], &ret, WUNTRACED);
+                        if (!WIFSTOPPED(ret))
+                            trace_exit (p[i], ret);
                         ret_code = WEXITSTATUS(ret);
                     }
                     else if (p[i] == -1)
                         ret_code = 254;
                 }
+                if (!WIFSTOPPED(ret))
+                    for (exec = cmd; exec != NULL; exec = exec->next)
+                    {
+                        wait_relays (exec->content);
+                        if (exec == save)
+                            break;
+                    }
+                if (stats != NULL && !WIFSTOPPED(ret))
+                {
+                    char **names = xcalloc (m + 1, sizeof (char *));
+                    for (i = 0; i < m; i++)
+                        waitpid (meters[i], NULL, 0);
+                    for (exec = cmd, i = 0; i <= m; exec = exec->next)
+                        names[i++] = exec->content->cmd;
+                    meter_report (stderr, stats, names, m + 1);
+                    xfree (names);
+                }
+                meter_free (stats, m);
+                xfree (meters);
                 xfree (p);
                 xfree (builtins);
+                xfree (cpus);
                 cmd = save;
                 break;
             }
@@ -673,5 +1346,6 @@ run_line (input_line *ptr)
             cmd = cmd->next;
         }
     }
+    in_place = NULL;
 /*    exit (ret_code);*/
 }
@@ -49,7 +49,7 @@ command_line *new_cmd_line (void);
 void free_cmd_line (command_line *ptr);
 
 /**
- * Free memory used by the given command
+ * Let a command go, its memory is freed once nobody holds it any longer
  * @param ptr Command that must be free'ed
  */
 void free_command (command *ptr);
@@ -62,12 +62,31 @@ void free_command (command *ptr);
 command_line *copy_cmd_line (const command_line *src);
 
 /**
- * Duplicates command
+ * Duplicates command, for a copy running on its own (ie. the copies of
+ * 'cmd |N>'). The copy has its own descriptors (pidfd, capture) but no relay:
+ * the original waits for its relays
  * @param src Command to duplicate
  * @return a new allocated command containing the same as src
  */
 command *copy_command (const command *src);
 
+/**
+ * Hold a command: the job list and fg share the command of the line that
+ * started it instead of copying it. free_command lets it go
+ * @param ptr Command to hold
+ * @return ptr
+ */
+command *ref_command (command *ptr);
+
+/**
+ * Get a command the caller alone holds before modifying it: the command
+ * itself if nobody else holds it, otherwise a copy (and the caller lets the
+ * shared one go)
+ * @param ptr Command held by the caller
+ * @return The command to modify
+ */
+command *own_command (command *ptr);
+
 /**
  * Parse the given command to separate the builtins from the rest and replace
  * the wildcards/variables/etc in order to execute in a subprocess for the
@@ -76,6 +95,44 @@ command *copy_command (const command *src);
  */
 void parse_command (command_line *ptrc);
 
+/**
+ * Execute the given command, either directly for the builtins or in a
+ * subprocess
+ * @param ptrc Command to run
+ * @return The pid of the subprocess (what the builtin returned for a
+ * builtin), -1 on error
+ */
+pid_t run_command (command_line *ptrc);
+
+/**
+ * Fill a new command with a list of words already expanded: they are not
+ * expanded again when it runs
+ * @param ptr The command
+ * @param argc Number of words (command included)
+ * @param argv Words (command included)
+ */
+void set_argv (command *ptr, int argc, char **argv);
+
+/**
+ * Execute a command given as a list of words already expanded, from a builtin
+ * running in a subprocess (ie. memo, onchange)
+ * @param argc Number of words (command included)
+ * @param argv Words (command included)
+ * @param in Descriptor of the standard input
+ * @param out Descriptor of the standard output
+ * @param err Descriptor of the standard error output
+ * @return The command-line of the command, its pid set as in run_command
+ */
+command_line *run_argv (int argc, char **argv, int in, int out, int err);
+
+/**
+ * Start a background job that waited for a slot (cf. queue_job)
+ * @param ptr Command of the job, its redirections still open. It is expanded
+ * again, so nobody else may hold it (cf. own_command)
+ * @return The pid of the subprocess, -1 on error
+ */
+pid_t start_job (command *ptr);
+
 /**
  * Execute the given input_line evaluating the command returns to set the
  * apropriate viariables
@@ -83,6 +140,13 @@ void parse_command (command_line *ptrc);
  */
 void run_line (input_line *ptr);
 
+/**
+ * Wait for the processes copying the outputs of the given command to their
+ * extra targets (ie. cmd >a >b)
+ * @param ptr Command whose relays must be waited
+ */
+void wait_relays (command *ptr);
+
 /**
  * Signal handler for SIGTSTP
  * @param sig Signal received
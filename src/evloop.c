@@ -0,0 +1,522 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "evloop.h"
+#include "options.h"
+#include "xutils.h"
+
+/* nb of requests in flight in the ring and of events handled per wakeup */
+#define RING_ENTRIES 64
+#define READY_MAX 32
+
+/* 6.15: waiting in the ring does not count as iowait (older headers) */
+#ifndef IORING_FEAT_NO_IOWAIT
+    #define IORING_FEAT_NO_IOWAIT (1U << 17)
+#endif
+#ifndef IORING_ENTER_NO_IOWAIT
+    #define IORING_ENTER_NO_IOWAIT (1U << 7)
+#endif
+
+typedef enum {
+    LOOP_POLL,
+    LOOP_URING,
+    LOOP_EPOLL
+} LoopBackend;
+
+typedef struct {
+    int fd;
+    evloop_cb cb;
+    void *data;
+    /* unique id of the source (stale completions of the ring are ignored) */
+    unsigned long long tag;
+    /* a poll request for the source is in the ring */
+    unsigned int armed;
+} source;
+
+static LoopBackend backend = LOOP_POLL;
+/* process owning the loop: a forked child must not touch the parent's ring */
+static pid_t owner = 0;
+static int loop_fd = -1;
+static source *sources = NULL;
+static int nb_sources = 0;
+static unsigned long long tags = 0;
+
+/* io_uring rings (cf. io_uring_setup(2)) */
+static unsigned char *ring = NULL;
+static size_t ring_len = 0;
+static struct io_uring_sqe *sqes = NULL;
+static size_t sqes_len = 0;
+static unsigned *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+static unsigned *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+static unsigned to_submit = 0;
+/* flags of the waits: an idle shell must not look like an I/O stall (PSI) */
+static unsigned wait_flags = 0;
+
+static long long
+now_ms (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static int
+find_source (int fd)
+{
+    int i;
+    for (i = 0; i < nb_sources; i++)
+        if (sources[i].fd == fd)
+            return i;
+    return -1;
+}
+
+static int
+find_tag (unsigned long long tag)
+{
+    int i;
+    for (i = 0; i < nb_sources; i++)
+        if (sources[i].tag == tag)
+            return i;
+    return -1;
+}
+
+static int
+uring_enter (unsigned submit, unsigned wait, unsigned flags, void *arg,
+             size_t size)
+{
+    return syscall (SYS_io_uring_enter, loop_fd, submit, wait, flags, arg,
+                    size);
+}
+
+/* Queue a request, it is submitted with the next wait */
+static void
+uring_push (unsigned char op, int fd, unsigned long long data,
+            unsigned long long addr)
+{
+    unsigned tail = *sq_tail, idx;
+    struct io_uring_sqe *sqe;
+    if (tail - __atomic_load_n (sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+    {
+        int r = uring_enter (to_submit, 0, 0, NULL, 0);
+        if (r > 0)
+            to_submit -= r;
+    }
+    idx = tail & *sq_mask;
+    sqe = &sqes[idx];
+    memset (sqe, 0, sizeof (*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = data;
+    sqe->addr = addr;
+    if (op == IORING_OP_POLL_ADD)
+        sqe->poll32_events = POLLIN;
+    sq_array[idx] = idx;
+    __atomic_store_n (sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+}
+
+static void
+uring_close (void)
+{
+    if (ring != NULL)
+        munmap (ring, ring_len);
+    if (sqes != NULL)
+        munmap (sqes, sqes_len);
+    ring = NULL;
+    sqes = NULL;
+    to_submit = 0;
+}
+
+static int
+uring_open (void)
+{
+    struct io_uring_params p;
+    size_t cq_len;
+    memset (&p, 0, sizeof (p));
+    loop_fd = syscall (SYS_io_uring_setup, RING_ENTRIES, &p);
+    if (loop_fd < 0)
+        return -1;
+    /* a wait with a timeout not taking a slot of the ring needs 5.11 */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_SINGLE_MMAP))
+        goto fail;
+    wait_flags = IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG;
+    if (p.features & IORING_FEAT_NO_IOWAIT)
+        wait_flags |= IORING_ENTER_NO_IOWAIT;
+    ring_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (cq_len > ring_len)
+        ring_len = cq_len;
+    ring = mmap (NULL, ring_len, PROT_READ|PROT_WRITE,
+                 MAP_SHARED|MAP_POPULATE, loop_fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED)
+    {
+        ring = NULL;
+        goto fail;
+    }
+    sqes_len = p.sq_entries * sizeof (struct io_uring_sqe);
+    sqes = mmap (NULL, sqes_len, PROT_READ|PROT_WRITE,
+                 MAP_SHARED|MAP_POPULATE, loop_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        sqes = NULL;
+        goto fail;
+    }
+    sq_head = (unsigned *) (ring + p.sq_off.head);
+    sq_tail = (unsigned *) (ring + p.sq_off.tail);
+    sq_mask = (unsigned *) (ring + p.sq_off.ring_mask);
+    sq_array = (unsigned *) (ring + p.sq_off.array);
+    sq_entries = p.sq_entries;
+    cq_head = (unsigned *) (ring + p.cq_off.head);
+    cq_tail = (unsigned *) (ring + p.cq_off.tail);
+    cq_mask = (unsigned *) (ring + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (ring + p.cq_off.cqes);
+    return 0;
+fail:
+    uring_close ();
+    close (loop_fd);
+    loop_fd = -1;
+    return -1;
+}
+
+/*
+ * Arm the sources and wait for completions in a single io_uring_enter. The
+ * poll requests are one-shot and re-armed at the next wait, which keeps the
+ * level-triggered semantics of poll(2)
+ * @return The nb of ready sources, -1 on error, -2 if the wait was cut short
+ * (signal or timeout: io_uring_enter hides it when it also submitted)
+ */
+static int
+uring_wait (int timeout, unsigned long long *ready)
+{
+    unsigned head, tail;
+    unsigned int entered = FALSE;
+    int i, n = 0;
+again:
+    for (i = 0; i < nb_sources; i++)
+    {
+        if (sources[i].armed)
+            continue;
+        uring_push (IORING_OP_POLL_ADD, sources[i].fd, sources[i].tag, 0);
+        sources[i].armed = TRUE;
+    }
+    head = *cq_head;
+    if (head == __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        int r;
+        memset (&arg, 0, sizeof (arg));
+        if (timeout >= 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000LL;
+            arg.ts = (unsigned long long) (unsigned long) &ts;
+        }
+        r = uring_enter (to_submit, 1, wait_flags, &arg, sizeof (arg));
+        if (r < 0)
+            return errno == ETIME ? 0 : -1;
+        to_submit -= r;
+        entered = TRUE;
+    }
+    tail = __atomic_load_n (cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && n < READY_MAX)
+    {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        int s = find_tag (cqe->user_data);
+        head++;
+        if (s < 0)
+            continue;
+        sources[s].armed = FALSE;
+        /* like poll(2), an error is reported for the reader to see it */
+        if (cqe->res != 0 && cqe->res != -ECANCELED)
+            ready[n++] = sources[s].tag;
+    }
+    __atomic_store_n (cq_head, head, __ATOMIC_RELEASE);
+    /* only stale or failed completions so far: re-arm and wait */
+    if (n == 0 && !entered)
+        goto again;
+    return n > 0 ? n : -2;
+}
+
+static int
+epoll_add (const source *src)
+{
+    struct epoll_event ev;
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = src->tag;
+    return epoll_ctl (loop_fd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+static int
+epoll_wait_ready (int timeout, unsigned long long *ready)
+{
+    struct epoll_event evs[READY_MAX];
+    int r = epoll_wait (loop_fd, evs, READY_MAX, timeout), i;
+    for (i = 0; i < r; i++)
+        ready[i] = evs[i].data.u64;
+    return r;
+}
+
+/* Last resort when neither io_uring nor epoll can be set up */
+static int
+poll_wait_ready (int timeout, unsigned long long *ready)
+{
+    struct pollfd *fds = xcalloc (nb_sources + 1, sizeof (struct pollfd));
+    int r, i, n = 0;
+    for (i = 0; i < nb_sources; i++)
+    {
+        fds[i].fd = sources[i].fd;
+        fds[i].events = POLLIN;
+    }
+    r = poll (fds, nb_sources, timeout);
+    for (i = 0; r > 0 && i < nb_sources && n < READY_MAX; i++)
+        if (fds[i].revents != 0)
+            ready[n++] = sources[i].tag;
+    xfree (fds);
+    return r < 0 ? -1 : n;
+}
+
+static void
+close_backend (void)
+{
+    if (backend == LOOP_URING)
+        uring_close ();
+    if (loop_fd >= 0)
+        close (loop_fd);
+    loop_fd = -1;
+    backend = LOOP_POLL;
+}
+
+void
+evloop_configure (void)
+{
+    const char *want = get_option ("loop.backend");
+    int i;
+    close_backend ();
+    owner = getpid ();
+    if (xstrcmp (want, "epoll") != 0 && uring_open () == 0)
+        backend = LOOP_URING;
+    else if ((loop_fd = epoll_create1 (EPOLL_CLOEXEC)) >= 0)
+        backend = LOOP_EPOLL;
+    for (i = 0; i < nb_sources; i++)
+    {
+        sources[i].armed = FALSE;
+        if (backend == LOOP_EPOLL)
+            epoll_add (&sources[i]);
+    }
+}
+
+void
+evloop_forget (void)
+{
+    if (owner == 0 || owner == getpid ())
+        return;
+    /* the backend and the sources are the parent's ones */
+    close_backend ();
+    xfree (sources);
+    sources = NULL;
+    nb_sources = 0;
+    owner = 0;
+}
+
+/* Set the loop up on first use, or again in a forked child */
+static void
+check_owner (void)
+{
+    if (owner == getpid ())
+        return;
+    evloop_forget ();
+    evloop_configure ();
+}
+
+void
+clear_evloop (void)
+{
+    if (owner == getpid ())
+        close_backend ();
+    xfree (sources);
+    sources = NULL;
+    nb_sources = 0;
+    owner = 0;
+}
+
+const char *
+evloop_backend (void)
+{
+    check_owner ();
+    switch (backend)
+    {
+    case LOOP_URING:
+        return "io_uring";
+    case LOOP_EPOLL:
+        return "epoll";
+    default:
+        return "poll";
+    }
+}
+
+int
+evloop_add (int fd, evloop_cb cb, void *data)
+{
+    int i;
+    source *src;
+    check_owner ();
+    i = find_source (fd);
+    if (i >= 0)
+    {
+        sources[i].cb = cb;
+        sources[i].data = data;
+        return 0;
+    }
+    sources = xrealloc (sources, (nb_sources + 1) * sizeof (source));
+    src = &sources[nb_sources];
+    src->fd = fd;
+    src->cb = cb;
+    src->data = data;
+    src->tag = ++tags;
+    src->armed = FALSE;
+    if (backend == LOOP_EPOLL && epoll_add (src) != 0)
+        return -1;
+    nb_sources++;
+    return 0;
+}
+
+void
+evloop_del (int fd)
+{
+    int i;
+    check_owner ();
+    i = find_source (fd);
+    if (i < 0)
+        return;
+    if (backend == LOOP_EPOLL)
+        epoll_ctl (loop_fd, EPOLL_CTL_DEL, fd, NULL);
+    /* the removal goes with the next wait, the fd may be closed before */
+    else if (backend == LOOP_URING && sources[i].armed)
+        uring_push (IORING_OP_POLL_REMOVE, -1, 0, sources[i].tag);
+    sources[i] = sources[--nb_sources];
+}
+
+int
+evloop_wait (int timeout)
+{
+    long long deadline = timeout >= 0 ? now_ms () + timeout : -1;
+    check_owner ();
+    while (1)
+    {
+        unsigned long long ready[READY_MAX];
+        int left = timeout, n, i, fd = -1;
+        if (timeout >= 0)
+            left = xmax ((int) (deadline - now_ms ()), 0);
+        if (backend == LOOP_URING)
+            n = uring_wait (left, ready);
+        else if (backend == LOOP_EPOLL)
+            n = epoll_wait_ready (left, ready);
+        else
+            n = poll_wait_ready (left, ready);
+        if (n == -2)
+        {
+            if (timeout < 0 || now_ms () < deadline)
+            {
+                errno = EINTR;
+                return -1;
+            }
+            n = 0;
+        }
+        if (n < 0)
+            return -1;
+        /* the callbacks may add or remove sources */
+        for (i = 0; i < n; i++)
+        {
+            int s = find_tag (ready[i]);
+            if (s < 0)
+                continue;
+            if (sources[s].cb != NULL)
+                sources[s].cb (sources[s].fd, sources[s].data);
+            else if (fd < 0)
+                fd = sources[s].fd;
+        }
+        if (fd >= 0)
+            return fd;
+        if (timeout >= 0 && now_ms () >= deadline)
+        {
+            errno = ETIME;
+            return -1;
+        }
+    }
+}
+
+ssize_t
+evloop_read (int fd, void *buf, size_t size)
+{
+    int r, e;
+    unsigned int watched;
+    check_owner ();
+    /*
+     * watched for this read only: the other waits do not know it and would
+     * spin on what is typed ahead
+     */
+    watched = find_source (fd) >= 0;
+    if (!watched && evloop_add (fd, NULL, NULL) != 0)
+        return read (fd, buf, size);
+    do
+        r = evloop_wait (-1);
+    while (r >= 0 && r != fd);
+    e = errno;
+    if (!watched)
+        evloop_del (fd);
+    if (r < 0)
+    {
+        errno = e;
+        return -1;
+    }
+    return read (fd, buf, size);
+}
@@ -0,0 +1,102 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EVLOOP_H_
+#define _EVLOOP_H_
+
+#include <sys/types.h>
+
+/**
+ * Function called when a watched descriptor becomes readable
+ * @param fd The descriptor
+ * @param data What was given to evloop_add
+ */
+typedef void (*evloop_cb) (int fd, void *data);
+
+/* Release the event loop */
+void clear_evloop (void);
+
+/**
+ * In a forked child, drop the loop of the parent: a new one is set up on first
+ * use. To be called before the descriptors of the parent are closed
+ */
+void evloop_forget (void);
+
+/**
+ * Switch to the backend set by the 'loop.backend' option: 'io_uring' or
+ * 'epoll' ('auto' tries io_uring first). The watched descriptors are kept.
+ */
+void evloop_configure (void);
+
+/**
+ * Get the backend really in use
+ * @return "io_uring", "epoll" or "none"
+ */
+const char *evloop_backend (void);
+
+/**
+ * Watch a descriptor (terminal, pidfd, inotify, signalfd...) until it is
+ * removed. Without callback, evloop_wait returns it when it is readable
+ * @param fd Descriptor to watch
+ * @param cb Function to call when it is readable or NULL
+ * @param data Given to the callback
+ * @return 0 on success, -1 on error
+ */
+int evloop_add (int fd, evloop_cb cb, void *data);
+
+/**
+ * Stop watching a descriptor. Must be called before closing it
+ * @param fd Descriptor to forget
+ */
+void evloop_del (int fd);
+
+/**
+ * Wait until one of the descriptors added without callback is readable,
+ * calling the callbacks of the other ones meanwhile
+ * @param timeout Maximum time to wait in ms, -1 for no limit
+ * @return The readable descriptor, -1 with errno set to ETIME on timeout or
+ * EINTR when interrupted by a signal
+ */
+int evloop_wait (int timeout);
+
+/**
+ * read(2) from a descriptor through the loop so the other sources are served
+ * while it is not readable. The descriptor is only watched during the call
+ * @param fd Descriptor to read from
+ * @param buf Buffer to fill
+ * @param size Size of the buffer
+ * @return What read returned, -1 with errno set to EINTR when interrupted
+ */
+ssize_t evloop_read (int fd, void *buf, size_t size);
+
+#endif
@@ -41,14 +41,160 @@
 #include <sys/wait.h>
 #include <string.h>
 #include <err.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 
 #include "jobs.h"
 #include "xutils.h"
 #include "command.h"
 #include "list.h"
+#include "trace.h"
+#include "rlimits.h"
+#include "evloop.h"
+#include "parser.h"
+#include "usage.h"
+#include "options.h"
+#include "throttle.h"
+#include "capture.h"
+
+/*
+ * nb of ended jobs whose status is kept for 'wait' at first. The array grows
+ * rather than losing a status nobody asked for yet
+ */
+#define DONE_JOBS 64
+/* initial nb of buckets of the pid index */
+#define JOB_BUCKETS 64
 
 static jobs *list = NULL;
+/* nb of walks of the list in progress (cf. hold_jobs) and what they delayed */
+static int holds = 0;
+static unsigned int unsettled = FALSE;
+
+/*
+ * jobs that ended before anybody waited for them (cf. forget_job), the oldest
+ * one first
+ */
+static struct _done_job {
+    pid_t pid;
+    int job;
+    int status;
+    /* status already given to 'wait', or job id given to another job */
+    unsigned int forgotten;
+    /* for 'jobs -l': the command, what it used and was it listed */
+    char *cmd;
+    job_usage use;
+    unsigned int listed;
+    /* ring with what it wrote (cf. jobs.capture), -1 if none */
+    int output;
+} *done_jobs = NULL;
+static int nb_done = 0, max_done = 0;
+
+/* SIGCHLD: a child changed state, and a pipe to wake the event loop up */
+static volatile sig_atomic_t children_changed = FALSE;
+static int chld_pipe[2] = {-1, -1};
+
+extern unsigned int interrupted;
+
+static void
+sigchldhandler (int sig)
+{
+    int e = errno;
+    ssize_t r;
+    children_changed = TRUE;
+    /* a full pipe is already readable */
+    r = write (chld_pipe[1], "", 1);
+    (void) r;
+    (void) sig;
+    errno = e;
+}
+
+/* Print the resource limits of a job if any (cf. the 'limit' prefix) */
+static void
+print_limits (const command *ptr)
+{
+    char buf[BUF];
+    if (format_limits (&ptr->lim, buf, sizeof (buf)))
+        fprintf (stdout, " [limits:%s]", buf);
+}
+
+/* Print the arguments of a job as they were typed */
+static void
+print_args (const command *ptr)
+{
+    int i;
+    for (i = 0; i < ptr->argc; i++)
+    {
+        char q;
+        switch (ptr->protected[i])
+        {
+            case NONE: q = '\0'; break;
+            case DOUBLE_QUOTE: q = '"'; break;
+            case SINGLE_QUOTE: q = '\'';
+        }
+        fprintf (stdout, " %c%s%c", q, ptr->argv[i], q);
+    }
+}
+
+/* Print the CPU cap of a job if any (cf. bg --cpu) */
+static void
+print_cap (const job *ptr)
+{
+    char buf[BUF];
+    if (format_cap (ptr, buf, sizeof (buf)))
+        fprintf (stdout, " [cap:%s]", buf);
+}
+
+/* Release the output kept for an ended job */
+static void
+drop_output (int d)
+{
+    if (done_jobs[d].output >= 0)
+        close (done_jobs[d].output);
+    done_jobs[d].output = -1;
+}
+
+/* Print the memory taken by the output of a job if it is kept */
+static void
+print_output (int ring)
+{
+    char buf[BUF];
+    if (format_capture (ring, buf, sizeof (buf)))
+        fprintf (stdout, " [output:%s]", buf);
+}
+
+/* Print the jobs a job waits for if any (cf. after) */
+static void
+print_deps (const job *ptr)
+{
+    int i;
+    if (ptr->deps == NULL)
+        return;
+    fprintf (stdout, " [after%s:", ptr->on_success ? "-success" : "");
+    for (i = 0; i < ptr->nb_deps; i++)
+    {
+        /* run in foreground meanwhile: it only has a pid */
+        if (ptr->deps[i].job != NULL)
+            fprintf (stdout, " %%%d", ptr->deps[i].job->content->job);
+        else
+            fprintf (stdout, " %d", ptr->deps[i].pid);
+    }
+    fprintf (stdout, "]");
+}
+
+/* Print what a running job used so far */
+static void
+print_usage (const command *ptr)
+{
+    char buf[BUF];
+    job_usage u;
+    if (!sample_usage (ptr->pid, &u))
+        return;
+    if (ptr->start > 0)
+        u.elapsed = usage_clock () - ptr->start;
+    if (format_usage (&u, buf, sizeof (buf)))
+        fprintf (stdout, " [usage:%s]", buf);
+}
 
 void
 clear_job (job *ptr)
@@ -62,6 +208,7 @@ clear_job (job *ptr)
                 ptr->content->cmd);
         */
         free_command (ptr->content);
+        xfree (ptr->deps);
         xfree (ptr);
     }
 }
@@ -76,6 +223,26 @@ init_jobs (void)
         list->head = NULL;
         list->tail = NULL;
         list->size = 0;
+        list->buckets = xcalloc (JOB_BUCKETS, sizeof (job *));
+        list->nb_buckets = JOB_BUCKETS;
+        list->slots = NULL;
+        list->nb_slots = 0;
+        list->free_ids = NULL;
+        list->nb_free = 0;
+        list->next_id = 1;
+        list->qhead = NULL;
+        list->qtail = NULL;
+        list->nb_queued = 0;
+    }
+    if (pipe2 (chld_pipe, O_CLOEXEC|O_NONBLOCK) == 0)
+    {
+        /* the interrupted calls restart, unless they never do (poll...) */
+        struct sigaction sa;
+        sa.sa_handler = sigchldhandler;
+        sigemptyset (&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        if (sigaction (SIGCHLD, &sa, NULL) != 0)
+            err (3, "sigaction");
     }
 }
 
@@ -83,14 +250,46 @@ void
 clear_jobs (void)
 {
     xdebug (NULL);
-    job *tmp = list->head;
+    job *tmp;
+    int i;
+    /* the throttled jobs must not stay stopped once the shell is gone */
+    clear_throttle ();
+    tmp = list->head;
     while (tmp != NULL)
     {
         job *tmp2 = tmp->next;
         clear_job (tmp);
         tmp = tmp2;
     }
+    xfree (list->buckets);
+    xfree (list->slots);
+    xfree (list->free_ids);
     xfree (list);
+    for (i = 0; i < nb_done; i++)
+    {
+        xfree (done_jobs[i].cmd);
+        drop_output (i);
+    }
+    xfree (done_jobs);
+    done_jobs = NULL;
+    nb_done = max_done = 0;
+    if (chld_pipe[0] >= 0)
+    {
+        signal (SIGCHLD, SIG_DFL);
+        evloop_del (chld_pipe[0]);
+        close (chld_pipe[0]);
+        close (chld_pipe[1]);
+        chld_pipe[0] = chld_pipe[1] = -1;
+    }
+}
+
+void
+forget_jobs (void)
+{
+    if (chld_pipe[0] < 0)
+        return;
+    signal (SIGCHLD, SIG_DFL);
+    chld_pipe[0] = chld_pipe[1] = -1;
 }
 
 static job *
@@ -99,34 +298,164 @@ new_job (command *ptr)
     job *ret = xmalloc (sizeof (*ret));
     if (ret != NULL)
     {
-        ret->content = copy_command (ptr);
+        ret->content = ref_command (ptr);
         ret->next = NULL;
         ret->prev = NULL;
+        ret->hnext = NULL;
+        ret->queued = FALSE;
+        ret->qnext = NULL;
+        ret->throttled = FALSE;
+        ret->foreground = FALSE;
+        ret->duty = NULL;
+        ret->deps = NULL;
+        ret->nb_deps = 0;
+        ret->on_success = FALSE;
+        ret->dep_failed = FALSE;
     }
     return ret;
 }
 
+static unsigned int
+pid_hash (pid_t pid, int nb_buckets)
+{
+    return (unsigned int) pid & (nb_buckets - 1);
+}
+
+/* Add a job to the pid index, doubling it when the chains get long */
+static void
+index_job (job *ptr)
+{
+    unsigned int h;
+    if (list->size > list->nb_buckets)
+    {
+        int i, nb = list->nb_buckets * 2;
+        job **buckets = xcalloc (nb, sizeof (job *));
+        for (i = 0; i < list->nb_buckets; i++)
+        {
+            job *tmp = list->buckets[i];
+            while (tmp != NULL)
+            {
+                job *next = tmp->hnext;
+                h = pid_hash (tmp->content->pid, nb);
+                tmp->hnext = buckets[h];
+                buckets[h] = tmp;
+                tmp = next;
+            }
+        }
+        xfree (list->buckets);
+        list->buckets = buckets;
+        list->nb_buckets = nb;
+    }
+    h = pid_hash (ptr->content->pid, list->nb_buckets);
+    ptr->hnext = list->buckets[h];
+    list->buckets[h] = ptr;
+}
+
+/* Remove a job from the pid index */
+static void
+unindex_job (job *ptr)
+{
+    job **tmp = &list->buckets[pid_hash (ptr->content->pid, 
+                                         list->nb_buckets)];
+    while (*tmp != NULL && *tmp != ptr)
+        tmp = &(*tmp)->hnext;
+    if (*tmp != NULL)
+        *tmp = ptr->hnext;
+}
+
+/* Take the lowest free job id: the top of the heap, or a new one */
 static int
 generate_job_number (void)
 {
-    int cpt = 1;
-    job *tmp = list->head;
-    while (tmp != NULL)
+    int *heap = list->free_ids;
+    int ret, last, i = 0;
+    if (list->nb_free == 0)
+        return list->next_id++;
+    ret = heap[0];
+    last = heap[--list->nb_free];
+    while (2 * i + 1 < list->nb_free)
     {
-        if (tmp->content->job == cpt)
-            cpt++;
-        tmp = tmp->next;
+        int c = 2 * i + 1;
+        if (c + 1 < list->nb_free && heap[c + 1] < heap[c])
+            c++;
+        if (last <= heap[c])
+            break;
+        heap[i] = heap[c];
+        i = c;
     }
-    return cpt;
+    heap[i] = last;
+    return ret;
 }
 
-void
-enqueue_job (command *ptr, unsigned int stopped)
+/* Give a job id back */
+static void
+release_job_number (int j)
+{
+    int *heap = list->free_ids;
+    int i = list->nb_free++;
+    /* an id is below next_id, so the heap fits in the slots' size */
+    while (i > 0 && heap[(i - 1) / 2] > j)
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = j;
+}
+
+/* Make room for the job id j in the job id index */
+static void
+grow_slots (int j)
+{
+    int i, nb = xmax (list->nb_slots * 2, JOB_BUCKETS);
+    if (j < list->nb_slots)
+        return;
+    while (nb <= j)
+        nb *= 2;
+    list->slots = xrealloc (list->slots, nb * sizeof (job *));
+    list->free_ids = xrealloc (list->free_ids, nb * sizeof (int));
+    for (i = list->nb_slots; i < nb; i++)
+        list->slots[i] = NULL;
+    list->nb_slots = nb;
+}
+
+/* Add a job to the list, waiting for a slot (without pid) or running */
+static job *
+add_job (command *ptr, unsigned int stopped, unsigned int queued)
 {
     job *tmp = new_job (ptr);
+    int i;
     tmp->content->job = generate_job_number ();
+    /* '%N' now designates the new job */
+    for (i = 0; i < nb_done; i++)
+        if (done_jobs[i].job == tmp->content->job)
+        {
+            done_jobs[i].forgotten = TRUE;
+            drop_output (i);
+        }
     tmp->content->stopped = stopped;
     list_append ((sdlist **)&list, (sddata *)tmp);
+    grow_slots (tmp->content->job);
+    list->slots[tmp->content->job] = tmp;
+    if (queued)
+    {
+        tmp->queued = TRUE;
+        tmp->content->pid = -1;
+        if (list->qtail != NULL)
+            list->qtail->qnext = tmp;
+        else
+            list->qhead = tmp;
+        list->qtail = tmp;
+        list->nb_queued++;
+    }
+    else
+        index_job (tmp);
+    return tmp;
+}
+
+void
+enqueue_job (command *ptr, unsigned int stopped)
+{
+    job *tmp = add_job (ptr, stopped, FALSE);
     if (stopped)
     {
         fprintf (stdout, "[%d] %d (%s) suspended\n",
@@ -137,116 +466,494 @@ enqueue_job (command *ptr, unsigned int stopped)
                          tmp->content->job, ptr->pid, ptr->cmd);
 }
 
+void
+queue_job (command *ptr)
+{
+    job *tmp = add_job (ptr, FALSE, TRUE);
+    fprintf (stdout, "[%d] queued (%s)\n", tmp->content->job, ptr->cmd);
+}
+
 int
-index_of (pid_t pid)
+nb_queued_jobs (void)
 {
-    job *tmp = list->head;
-    int i = 0;
-    while (tmp != NULL)
+    return list->nb_queued;
+}
+
+unsigned int
+job_slot_free (void)
+{
+    int max = get_option_int ("jobs.max");
+    return max <= 0 || list->size - list->nb_queued < max;
+}
+
+/* Take a job out of the queue */
+static void
+unqueue_job (job *ptr)
+{
+    job *prev = NULL, *tmp = list->qhead;
+    while (tmp != NULL && tmp != ptr)
     {
-        if (tmp->content->pid == pid)
-            break;
-        tmp = tmp->next;
-        i++;
+        prev = tmp;
+        tmp = tmp->qnext;
     }
     if (tmp == NULL)
-        return -1;
-    return i;
+        return;
+    if (prev != NULL)
+        prev->qnext = ptr->qnext;
+    else
+        list->qhead = ptr->qnext;
+    if (list->qtail == ptr)
+        list->qtail = prev;
+    ptr->qnext = NULL;
+    ptr->queued = FALSE;
+    list->nb_queued--;
+    /* started or gone: it does not wait for anything any longer */
+    xfree (ptr->deps);
+    ptr->deps = NULL;
+    ptr->nb_deps = 0;
 }
 
-job *
-get_job (int i)
+unsigned int
+launch_job (job *ptr)
 {
-    if (i < 0)
-        return NULL;
-    job *tmp = list->head;
-    int cpt = 0;
-    while (tmp != NULL && cpt < i)
+    pid_t pid;
+    unqueue_job (ptr);
+    /* the line may still hold the command start_job expands again */
+    ptr->content = own_command (ptr->content);
+    pid = start_job (ptr->content);
+    if (pid == -1)
     {
-        tmp = tmp->next;
-        cpt++;
+        fprintf (stderr, "[%d] (%s) could not be started\n",
+                         ptr->content->job,
+                         ptr->content->cmd);
+        remove_job (ptr);
+        return FALSE;
+    }
+    ptr->content->pid = pid;
+    index_job (ptr);
+    fprintf (stdout, "[%d] %d (%s)\n",
+                     ptr->content->job,
+                     pid,
+                     ptr->content->cmd);
+    return TRUE;
+}
+
+int
+admit_jobs (void)
+{
+    int nb = 0;
+    unsigned int nice = option_is ("jobs.order", "nice");
+    while (list->nb_queued > 0 && job_slot_free ())
+    {
+        job *tmp, *next = list->qhead;
+        /* the jobs still waiting for other ones are left in the queue */
+        while (next != NULL && next->deps != NULL)
+            next = next->qnext;
+        if (next == NULL)
+            break;
+        /* nice: the lowest 'limit --nice' first, in queue order if equal */
+        if (nice)
+        {
+            for (tmp = next->qnext; tmp != NULL; tmp = tmp->qnext)
+            {
+                const limits *a = &tmp->content->lim, *b = &next->content->lim;
+                if (tmp->deps == NULL &&
+                    (a->set_nice ? a->nice : 0) < (b->set_nice ? b->nice : 0))
+                    next = tmp;
+            }
+        }
+        if (launch_job (next))
+            nb++;
     }
+    return nb;
+}
+
+void
+flush_queue (int j)
+{
+    job *tmp;
+    if (chld_pipe[0] < 0)
+        return;
+    evloop_add (chld_pipe[0], NULL, NULL);
+    admit_jobs ();
+    while (j > 0 ? (tmp = get_job_by_job_id (j)) != NULL && tmp->queued :
+                   list->nb_queued > 0)
+    {
+        char buf[BUF];
+        if (!children_changed && evloop_wait (-1) < 0 && errno == EINTR &&
+            interrupted)
+            break;
+        while (read (chld_pipe[0], buf, sizeof (buf)) > 0);
+        /* the jobs that end free the slots of the queued ones */
+        reap_jobs (FALSE);
+    }
+    evloop_del (chld_pipe[0]);
+}
+
+job *
+get_job_by_pid (pid_t pid)
+{
+    job *tmp = list->buckets[pid_hash (pid, list->nb_buckets)];
+    while (tmp != NULL && tmp->content->pid != pid)
+        tmp = tmp->hnext;
     return tmp;
 }
 
+job *
+get_first_job (void)
+{
+    return list->head;
+}
+
 job *
 get_last_job (void)
 {
     return list->tail;
 }
 
-void
-remove_job (int i)
+int
+nb_jobs (void)
 {
-    list_remove_id ((sdlist **)&list, i, (free_c)free_command);
+    return list->size;
 }
 
+/* Did a job return 0 */
 static unsigned int
-is_job_done (pid_t pid, unsigned int print, unsigned int details)
+succeeded (int status)
 {
-    int status;
-    int idx = index_of (pid);
-    job *j = get_job (idx);
-    const char l = (j == list->tail) ? '+' : '-';
-    pid_t p = waitpid (pid, &status, WNOHANG|WUNTRACED);
-    if (p == -1)
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Queue or cancel the jobs that do not wait for anything any longer */
+static void
+settle_deps (void)
+{
+    job *tmp = list->head;
+    /* the list is being walked: a cancelled job may be the next one */
+    if (holds > 0)
     {
-        warn ("jobs [%d] %d (%s)", j->content->job,
-                                   j->content->pid,
-                                   j->content->cmd);
-        remove_job (idx);
-        return TRUE;
+        unsettled = TRUE;
+        return;
     }
-    if (j == NULL)
+    while (tmp != NULL)
     {
-        fprintf (stderr, "'%d': no such job\n", pid);
+        if (tmp->deps == NULL || tmp->nb_deps > 0)
+        {
+            tmp = tmp->next;
+            continue;
+        }
+        xfree (tmp->deps);
+        tmp->deps = NULL;
+        if (tmp->on_success && tmp->dep_failed)
+        {
+            fprintf (stdout, "[%d] (%s) cancelled: a job it waited for failed\n",
+                             tmp->content->job,
+                             tmp->content->cmd);
+            if (tmp->content->out != STDOUT_FILENO &&
+                tmp->content->out != STDERR_FILENO)
+                close (tmp->content->out);
+            if (tmp->content->err != STDERR_FILENO &&
+                tmp->content->err != STDOUT_FILENO)
+                close (tmp->content->err);
+            /* the ones waiting for it are told in turn */
+            remove_job (tmp);
+            tmp = list->head;
+            continue;
+        }
+        tmp = tmp->next;
+    }
+    admit_jobs ();
+}
+
+void
+hold_jobs (void)
+{
+    holds++;
+}
+
+void
+release_jobs (void)
+{
+    if (--holds > 0 || !unsettled)
+        return;
+    unsettled = FALSE;
+    settle_deps ();
+}
+
+/*
+ * A job (or a command run in foreground, by pid) ended or went away: the jobs
+ * waiting for it do not any longer
+ */
+static void
+resolve_deps (const job *dep, pid_t pid, unsigned int ok)
+{
+    unsigned int found = FALSE;
+    job *tmp;
+    for (tmp = list->head; tmp != NULL; tmp = tmp->next)
+    {
+        int i = 0;
+        while (i < tmp->nb_deps)
+        {
+            if ((dep != NULL && tmp->deps[i].job == dep) ||
+                (pid > 0 && tmp->deps[i].pid == pid))
+            {
+                tmp->deps[i] = tmp->deps[--tmp->nb_deps];
+                if (!ok)
+                    tmp->dep_failed = TRUE;
+                found = TRUE;
+            }
+            else
+                i++;
+        }
+    }
+    if (found)
+        settle_deps ();
+}
+
+/* A job leaves the list: the ones waiting for it follow it by its pid */
+static void
+forget_deps (const job *dep)
+{
+    job *tmp;
+    int i;
+    if (dep->content->pid <= 0)
+    {
+        /* never started: it will not end */
+        resolve_deps (dep, -1, FALSE);
+        return;
+    }
+    for (tmp = list->head; tmp != NULL; tmp = tmp->next)
+        for (i = 0; i < tmp->nb_deps; i++)
+            if (tmp->deps[i].job == dep)
+            {
+                tmp->deps[i].job = NULL;
+                tmp->deps[i].pid = dep->content->pid;
+            }
+}
+
+/* Does a job wait for another one, directly or not */
+static unsigned int
+waits_for (const job *ptr, const job *dep)
+{
+    int i;
+    if (ptr == dep)
         return TRUE;
+    for (i = 0; i < ptr->nb_deps; i++)
+        if (ptr->deps[i].job != NULL && waits_for (ptr->deps[i].job, dep))
+            return TRUE;
+    return FALSE;
+}
+
+int
+add_deps (job *ptr, job **deps, int nb, unsigned int on_success)
+{
+    int i;
+    for (i = 0; i < nb; i++)
+        if (waits_for (deps[i], ptr))
+            return -1;
+    ptr->deps = xrealloc (ptr->deps, (ptr->nb_deps + nb + 1) * sizeof (job_dep));
+    for (i = 0; i < nb; i++)
+    {
+        ptr->deps[ptr->nb_deps].job = deps[i];
+        ptr->deps[ptr->nb_deps].pid = -1;
+        ptr->nb_deps++;
     }
-    if (j->content->stopped && print)
+    ptr->on_success |= on_success;
+    settle_deps ();
+    return 0;
+}
+
+void
+after_job (command *ptr, job **deps, int nb, unsigned int on_success)
+{
+    job *tmp = add_job (ptr, FALSE, TRUE);
+    fprintf (stdout, "[%d] waiting (%s)\n", tmp->content->job, ptr->cmd);
+    add_deps (tmp, deps, nb, on_success);
+}
+
+void
+job_exited (pid_t pid, int status)
+{
+    resolve_deps (NULL, pid, succeeded (status));
+}
+
+void
+remove_job (job *ptr)
+{
+    if (ptr == NULL)
+        return;
+    uncap_job (ptr);
+    if (ptr->queued)
+        unqueue_job (ptr);
+    else
+        unindex_job (ptr);
+    list->slots[ptr->content->job] = NULL;
+    if (ptr->prev != NULL)
+        ptr->prev->next = ptr->next;
+    else
+        list->head = ptr->next;
+    if (ptr->next != NULL)
+        ptr->next->prev = ptr->prev;
+    else
+        list->tail = ptr->prev;
+    list->size--;
+    /* no more jobs: the numbering starts over */
+    if (list->size == 0)
     {
-        if (details)
+        list->nb_free = 0;
+        list->next_id = 1;
+    }
+    else
+        release_job_number (ptr->content->job);
+    forget_deps (ptr);
+    clear_job (ptr);
+}
+
+/**
+ * Get a free entry to keep an ended job. When they are all taken, the ones with
+ * nothing left to give (waited for, listed and without output) make room,
+ * otherwise the array grows
+ * @return The index of the entry
+ */
+static int
+new_done_job (void)
+{
+    int i, n = 0;
+    if (nb_done == max_done)
+    {
+        for (i = 0; i < nb_done; i++)
         {
-            int i;
-            fprintf (stdout, "[%d]  %c %d suspended: %s",
-                             j->content->job,
-                             l,
-                             pid,
-                             j->content->cmd);
-            for (i = 0; i < j->content->argc; i++)
+            if (done_jobs[i].forgotten && done_jobs[i].listed &&
+                done_jobs[i].output < 0)
             {
-                char q;
-                switch (j->content->protected[i])
-                {
-                    case NONE: q = '\0'; break;
-                    case DOUBLE_QUOTE: q = '"'; break;
-                    case SINGLE_QUOTE: q = '\'';
-                }
-                fprintf (stdout, " %c%s%c", q, j->content->argv[i], q);
+                xfree (done_jobs[i].cmd);
+                continue;
             }
-            fprintf (stdout, "\n");
+            done_jobs[n++] = done_jobs[i];
         }
+        nb_done = n;
+    }
+    if (nb_done == max_done)
+    {
+        max_done = max_done > 0 ? max_done * 2 : DONE_JOBS;
+        done_jobs = xrealloc (done_jobs, max_done * sizeof (*done_jobs));
+    }
+    done_jobs[nb_done].cmd = NULL;
+    done_jobs[nb_done].output = -1;
+    return nb_done++;
+}
+
+/* Remove a job that ended, keeping what it used if nobody waited for it */
+static void
+finish_job (job *j, int status, unsigned int waited, const struct rusage *ru)
+{
+    pid_t pid;
+    if (j == NULL)
+        return;
+    pid = j->content->pid;
+    trace_exit (pid, status);
+    wait_relays (j->content);
+    /* waited for, only the output it kept is left to give (cf. jobs output) */
+    if (!waited || j->content->capture >= 0)
+    {
+        int d = new_done_job ();
+        job_usage *u = &done_jobs[d].use;
+        done_jobs[d].pid = j->content->pid;
+        done_jobs[d].job = j->content->job;
+        done_jobs[d].status = status;
+        done_jobs[d].forgotten = waited;
+        done_jobs[d].cmd = xstrdup (j->content->cmd);
+        done_jobs[d].listed = waited;
+        /* 'jobs output' still has it until the job id is given again */
+        done_jobs[d].output = j->content->capture;
+        j->content->capture = -1;
+        if (ru != NULL)
+            rusage_usage (ru, u);
         else
+            u->cpu = u->rss = u->maxrss = u->inblock = u->oublock = -1;
+        u->elapsed = j->content->start > 0 ?
+                        usage_clock () - j->content->start :
+                        -1;
+    }
+    remove_job (j);
+    /* its slot is free: the jobs that waited for it may take it */
+    resolve_deps (NULL, pid, succeeded (status));
+}
+
+void
+end_job (job *j, int status, unsigned int waited)
+{
+    finish_job (j, status, waited, NULL);
+}
+
+unsigned int
+ended_job_status (int j, int *status)
+{
+    int i;
+    /* the newest one: the job id may have been given again since */
+    for (i = nb_done - 1; i >= 0; i--)
+    {
+        if (done_jobs[i].job == j)
         {
-            fprintf (stdout, "[%d]  %c %d (%s) suspended\n",
-                             j->content->job,
-                             l,
-                             pid,
-                             j->content->cmd);
+            *status = done_jobs[i].status;
+            return TRUE;
         }
-        /* well, it's a lie but we don't want to print it twice */
+    }
+    return FALSE;
+}
+
+int
+job_output (int j)
+{
+    job *tmp = get_job_by_job_id (j);
+    int i;
+    if (tmp != NULL)
+        return tmp->content->capture;
+    for (i = 0; i < nb_done; i++)
+        if (done_jobs[i].job == j && done_jobs[i].output >= 0)
+            return done_jobs[i].output;
+    return -1;
+}
+
+unsigned int
+forget_job (pid_t pid, int j, int *status)
+{
+    int i;
+    for (i = 0; i < nb_done; i++)
+    {
+        if (done_jobs[i].pid <= 0 || done_jobs[i].forgotten ||
+            (pid > 0 && done_jobs[i].pid != pid) ||
+            (pid <= 0 && done_jobs[i].job != j))
+            continue;
+        *status = done_jobs[i].status;
+        done_jobs[i].forgotten = TRUE;
         return TRUE;
     }
-    if (p == 0)
-        return FALSE;
+    return FALSE;
+}
+
+/* A stop already known (throttle) or of the duty cycle is not worth a word */
+static unsigned int
+quiet_stop (const job *j, int status)
+{
+    return WIFSTOPPED(status) != 0 &&
+           (j->content->stopped || j->duty != NULL);
+}
+
+/* Print what happened to a job and remove it if it ended */
+static unsigned int
+report_job (job *j, int status, const struct rusage *ru)
+{
+    const char l = (j == list->tail) ? '+' : '-';
     if (WIFEXITED(status) != 0)
     {
         fprintf (stdout, "[%d]  %c %d (%s) done. Returned %d\n",
                          j->content->job,
                          l,
-                         pid,
+                         j->content->pid,
                          j->content->cmd,
                          WEXITSTATUS(status));
-        remove_job (idx);
+        finish_job (j, status, FALSE, ru);
         return TRUE;
     }
     else if (WIFSIGNALED(status) != 0)
@@ -255,42 +962,221 @@ is_job_done (pid_t pid, unsigned int print, unsigned int details)
         fprintf (stdout, "[%d]  %c %d (%s) interrupted. Signal %d (%s)\n",
                          j->content->job,
                          l,
-                         pid,
+                         j->content->pid,
                          j->content->cmd,
                          sig,
                          strsignal (sig));
-        remove_job (idx);
+        finish_job (j, status, FALSE, ru);
+        return TRUE;
+    }
+    else if (WIFSTOPPED(status) != 0 && !quiet_stop (j, status))
+    {
+        j->content->stopped = TRUE;
+        fprintf (stdout, "[%d]  %c %d (%s) suspended\n",
+                         j->content->job,
+                         l,
+                         j->content->pid,
+                         j->content->cmd);
         return TRUE;
     }
     return FALSE;
 }
 
-job *
-get_job_by_job_id (int j)
+static unsigned int
+is_job_done (job *j, unsigned int print, unsigned int details)
 {
-    job *tmp = list->head;
-    while (tmp != NULL)
+    int status;
+    struct rusage ru;
+    pid_t pid = j->content->pid;
+    const char l = (j == list->tail) ? '+' : '-';
+    pid_t p;
+    /* no process yet: nothing to collect */
+    if (j->queued)
+    {
+        const char *state = j->deps != NULL ? "waiting" : "queued";
+        if (print && details)
+        {
+            fprintf (stdout, "[%d]  %c %s: %s", j->content->job,
+                                              l,
+                                              state,
+                                              j->content->cmd);
+            print_args (j->content);
+            print_limits (j->content);
+            print_deps (j);
+            fprintf (stdout, "\n");
+        }
+        else if (print)
+        {
+            fprintf (stdout, "[%d]  %c (%s) %s", j->content->job,
+                                                l,
+                                                j->content->cmd,
+                                                state);
+            print_deps (j);
+            fprintf (stdout, "\n");
+        }
+        return TRUE;
+    }
+    p = wait4 (pid, &status, WNOHANG|WUNTRACED, &ru);
+    if (p == -1)
+    {
+        warn ("jobs [%d] %d (%s)", j->content->job,
+                                   j->content->pid,
+                                   j->content->cmd);
+        wait_relays (j->content);
+        remove_job (j);
+        return TRUE;
+    }
+    if (j->content->stopped && print)
     {
-        if (tmp->content->job == j)
+        if (details)
+        {
+            fprintf (stdout, "[%d]  %c %d %s: %s",
+                             j->content->job,
+                             l,
+                             pid,
+                             j->throttled ? "throttled" : "suspended",
+                             j->content->cmd);
+            print_args (j->content);
+            print_limits (j->content);
+            print_cap (j);
+            print_output (j->content->capture);
+            print_usage (j->content);
+            fprintf (stdout, "\n");
+        }
+        else
+        {
+            fprintf (stdout, "[%d]  %c %d (%s) %s\n",
+                             j->content->job,
+                             l,
+                             pid,
+                             j->content->cmd,
+                             j->throttled ? "throttled" : "suspended");
+        }
+        /* well, it's a lie but we don't want to print it twice */
+        return TRUE;
+    }
+    if (p == 0)
+        return FALSE;
+    return report_job (j, status, &ru);
+}
+
+/* A child that is not a job ended: it may be the relay of one */
+static void
+forget_child (pid_t pid)
+{
+    job *tmp;
+    for (tmp = list->head; tmp != NULL; tmp = tmp->next)
+    {
+        if (tmp->content->relay_out == pid)
+            tmp->content->relay_out = -1;
+        if (tmp->content->relay_err == pid)
+            tmp->content->relay_err = -1;
+    }
+}
+
+int
+reap_jobs (unsigned int redraw)
+{
+    int nb = 0;
+    if (!children_changed)
+        return 0;
+    children_changed = FALSE;
+    for (;;)
+    {
+        struct rusage ru;
+        int status;
+        job *j;
+        /* waitid (P_ALL) but with the resource usage */
+        pid_t p = wait4 (-1, &status, WNOHANG|WUNTRACED, &ru);
+        if (p <= 0)
             break;
-        tmp = tmp->next;
+        j = get_job_by_pid (p);
+        if (j == NULL)
+        {
+            forget_child (p);
+            continue;
+        }
+        if (quiet_stop (j, status))
+            continue;
+        /* leave the line being typed */
+        if (redraw && nb == 0)
+            fprintf (stdout, "\n");
+        if (report_job (j, status, &ru))
+            nb++;
     }
-    return tmp;
+    /* the jobs that ended left their slots to the queued ones */
+    if (list->nb_queued > 0 && job_slot_free ())
+    {
+        if (redraw && nb == 0)
+            fprintf (stdout, "\n");
+        nb += admit_jobs ();
+    }
+    if (redraw && nb > 0)
+        redraw_line ();
+    return nb;
+}
+
+static void
+job_changed (int fd, void *data)
+{
+    char buf[BUF];
+    while (read (fd, buf, sizeof (buf)) > 0);
+    reap_jobs (TRUE);
+    (void) data;
+}
+
+void
+watch_jobs (unsigned int on)
+{
+    if (chld_pipe[0] < 0)
+        return;
+    if (on)
+        evloop_add (chld_pipe[0], job_changed, NULL);
+    else
+        evloop_del (chld_pipe[0]);
+}
+
+pid_t
+wait_foreground (pid_t pid, int *status, int options)
+{
+    pid_t r;
+    if (!throttle_active () || chld_pipe[0] < 0)
+        return waitpid (pid, status, options);
+    /* SIGCHLD wakes the loop up when the command ends or stops */
+    evloop_add (chld_pipe[0], NULL, NULL);
+    while ((r = waitpid (pid, status, options|WNOHANG)) == 0)
+    {
+        char buf[BUF];
+        if (evloop_wait (-1) == chld_pipe[0])
+            while (read (chld_pipe[0], buf, sizeof (buf)) > 0);
+    }
+    evloop_del (chld_pipe[0]);
+    return r;
+}
+
+job *
+get_job_by_job_id (int j)
+{
+    if (j <= 0 || j >= list->nb_slots)
+        return NULL;
+    return list->slots[j];
 }
 
 command *
 get_last_enqueued_job (unsigned int flush)
 {
     command *ret;
+    /* asked for by name: it does not wait for a slot any longer */
+    if (list->tail != NULL && list->tail->queued && !launch_job (list->tail))
+        return NULL;
     if (flush && list->tail != NULL)
     {
-        xdebug ("cloning job [%d] %d (%s)",
+        xdebug ("taking job [%d] %d (%s)",
                 list->tail->content->job,
                 list->tail->content->pid,
                 list->tail->content->cmd);
-        ret = copy_command (list->tail->content);
-        int idx = index_of (list->tail->content->pid);
-        remove_job (idx);
+        ret = ref_command (list->tail->content);
+        remove_job (list->tail);
     }
     else if (list->tail != NULL)
         ret = list->tail->content;
@@ -299,40 +1185,63 @@ get_last_enqueued_job (unsigned int flush)
     return ret;
 }
 
+/* List the jobs that ended since the last 'jobs -l' with what they used */
+static void
+list_done_jobs (void)
+{
+    int d;
+    for (d = 0; d < nb_done; d++)
+    {
+        int status = done_jobs[d].status;
+        char buf[BUF];
+        if (done_jobs[d].listed)
+            continue;
+        done_jobs[d].listed = TRUE;
+        if (WIFSIGNALED(status))
+            fprintf (stdout, "[%d]    %d (%s) interrupted. Signal %d (%s)",
+                             done_jobs[d].job,
+                             done_jobs[d].pid,
+                             done_jobs[d].cmd,
+                             WTERMSIG(status),
+                             strsignal (WTERMSIG(status)));
+        else
+            fprintf (stdout, "[%d]    %d (%s) done. Returned %d",
+                             done_jobs[d].job,
+                             done_jobs[d].pid,
+                             done_jobs[d].cmd,
+                             WEXITSTATUS(status));
+        if (format_usage (&done_jobs[d].use, buf, sizeof (buf)))
+            fprintf (stdout, " [usage:%s]", buf);
+        print_output (done_jobs[d].output);
+        fprintf (stdout, "\n");
+    }
+}
+
 void
 list_jobs (unsigned int print, int *pids, int cpt, unsigned int details)
 {
     if (pids == NULL)
     {
         job *tmp = list->head;
+        hold_jobs ();
         while (tmp != NULL)
         {
             job *tmp2 = tmp->next;
             const char l = (tmp == list->tail) ? '+' : '-';
-            if (!is_job_done (tmp->content->pid, print, details) && print)
+            if (!is_job_done (tmp, print, details) && print)
             {
                 if (details)
                 {
-                    int i;
                     fprintf (stdout, "[%d]  %c %d running: %s",
                                      tmp->content->job,
                                      l,
                                      tmp->content->pid,
                                      tmp->content->cmd);
-                    for (i = 0; i < tmp->content->argc; i++)
-                    {
-                        char q;
-                        switch (tmp->content->protected[i])
-                        {
-                            case NONE: q = '\0'; break;
-                            case DOUBLE_QUOTE: q = '"'; break;
-                            case SINGLE_QUOTE: q = '\'';
-                        }
-                        fprintf (stdout, " %c%s%c",
-                                         q,
-                                         tmp->content->argv[i],
-                                         q);
-                    }
+                    print_args (tmp->content);
+                    print_limits (tmp->content);
+                    print_cap (tmp);
+                    print_output (tmp->content->capture);
+                    print_usage (tmp->content);
                     fprintf (stdout, "\n");
                 }
                 else
@@ -346,38 +1255,36 @@ list_jobs (unsigned int print, int *pids, int cpt, unsigned int details)
             }
             tmp = tmp2;
         }
+        release_jobs ();
+        if (print && details)
+            list_done_jobs ();
     }
     else
     {
         int i;
         for (i = 0; i < cpt; i++)
         {
-            if (!is_job_done (pids[i], print, details) && print)
+            job *tmp = get_job_by_pid (pids[i]);
+            if (tmp == NULL)
+            {
+                fprintf (stderr, "'%d': no such job\n", pids[i]);
+                continue;
+            }
+            if (!is_job_done (tmp, print, details) && print)
             {
-                job *tmp = get_job (index_of (pids[i]));
                 const char l = (tmp == list->tail) ? '+' : '-';
                 if (details)
                 {
-                    int j;
                     fprintf (stdout, "[%d]  %c %d running: %s",
                                      tmp->content->job,
                                      l,
                                      tmp->content->pid,
                                      tmp->content->cmd);
-                    for (j = 0; j < tmp->content->argc; j++)
-                    {
-                        char q;
-                        switch (tmp->content->protected[j])
-                        {
-                            case NONE: q = '\0'; break;
-                            case DOUBLE_QUOTE: q = '"'; break;
-                            case SINGLE_QUOTE: q = '\'';
-                        }
-                        fprintf (stdout, " %c%s%c",
-                                         q,
-                                         tmp->content->argv[j],
-                                         q);
-                    }
+                    print_args (tmp->content);
+                    print_limits (tmp->content);
+                    print_cap (tmp);
+                    print_output (tmp->content->capture);
+                    print_usage (tmp->content);
                     fprintf (stdout, "\n");
                 }
                 else
@@ -38,6 +38,18 @@
 
 typedef struct _jobs jobs;
 typedef struct _job job;
+typedef struct _duty duty;
+typedef struct _job_dep job_dep;
+
+/*
+ * A job another one waits for (cf. after): the job itself while it is in the
+ * list, its pid once it left it to run in foreground
+ */
+struct _job_dep
+{
+    job *job;
+    pid_t pid;
+};
 
 /* A job is simply a command */
 struct _job
@@ -46,6 +58,25 @@ struct _job
 
     job *next;
     job *prev;
+
+    /* next job in the same bucket of the pid index */
+    job *hnext;
+    /* waiting for a slot (cf. jobs.max), and the next one waiting */
+    unsigned int queued;
+    job *qnext;
+    /* stopped because of the pressure on the system (cf. jobs.throttle) */
+    unsigned int throttled;
+    /* waited for by fg along with other jobs: never throttled nor capped */
+    unsigned int foreground;
+    /* duty cycle capping its CPU share (cf. bg --cpu), NULL if none */
+    duty *duty;
+    /* jobs to wait for before being admitted (cf. after), NULL if none */
+    job_dep *deps;
+    int nb_deps;
+    /* only started if they all returned 0 (cf. after-success) */
+    unsigned int on_success;
+    /* one of them did not */
+    unsigned int dep_failed;
 };
 
 struct _jobs
@@ -53,6 +84,21 @@ struct _jobs
     job *head;
     job *tail;
     int size;
+
+    /* pid index: nb_buckets (a power of 2) chains of jobs */
+    job **buckets;
+    int nb_buckets;
+    /* job id index: slots[j] is the job '%j' */
+    job **slots;
+    int nb_slots;
+    /* ids given back below next_id, as a min-heap */
+    int *free_ids;
+    int nb_free;
+    int next_id;
+    /* jobs waiting for a slot, in the order they were queued */
+    job *qhead;
+    job *qtail;
+    int nb_queued;
 };
 
 /**
@@ -73,6 +119,13 @@ void init_jobs (void);
 /* Clear jobs list */
 void clear_jobs (void);
 
+/**
+ * In a child of the shell that does not exec, drop the SIGCHLD handler and
+ * the pipe waking the shell up: they are the shell's ones. The caller closes
+ * the descriptors
+ */
+void forget_jobs (void);
+
 /**
  * Get a job by its job id
  * @param j The job id
@@ -83,7 +136,8 @@ job *get_job_by_job_id (int j);
 /**
  * Return the last enqueued job that has been stopped by SIGTSTP (^Z)
  * @param flush If TRUE, remove the job from the job queue (when we continue it
- * in foreground for instance)
+ * in foreground for instance): its command is then held for the caller, who
+ * lets it go with free_command
  * @return The last job enqueued
  */
 command *get_last_enqueued_job (unsigned int flush);
@@ -95,18 +149,23 @@ command *get_last_enqueued_job (unsigned int flush);
 void clear_job (job *ptr);
 
 /**
- * Return the index of the job of the given pid
+ * Return the job of the given pid
  * @param pid PID of the job
- * @return Index of the job
+ * @return The job, NULL if there is none
+ */
+job * get_job_by_pid (pid_t pid);
+
+/**
+ * Return the first job in the list (the others follow through next)
+ * @return The first job
  */
-int index_of (pid_t pid);
+job * get_first_job (void);
 
 /**
- * Return the job of the given index
- * @param i Index of the job
- * @return The job
+ * Return the number of jobs
+ * @return The number of jobs in the list
  */
-job * get_job (int i);
+int nb_jobs (void);
 
 /**
  * Return the last job in the list
@@ -116,8 +175,146 @@ job * get_last_job (void);
 
 /**
  * Remove a job
- * @param i Index of the job
+ * @param ptr The job
+ */
+void remove_job (job *ptr);
+
+/**
+ * Remove a job that ended, its status being collected
+ * @param ptr The job
+ * @param status Status of the job as returned by waitpid
+ * @param waited TRUE if somebody waited for the job, otherwise its status is
+ * kept for a later 'wait' (cf. forget_job)
+ */
+void end_job (job *ptr, int status, unsigned int waited);
+
+/**
+ * Get the status of a job that ended before anybody waited for it, and forget
+ * it
+ * @param pid PID of the job (0 to look for the job id instead)
+ * @param j Job id
+ * @param status Receives the status of the job as returned by waitpid
+ * @return TRUE if the job was found
+ */
+unsigned int forget_job (pid_t pid, int j, int *status);
+
+/**
+ * Get the ring keeping the output of a job (cf. jobs.capture), running or
+ * ended, as long as its job id was not given to another one
+ * @param j Job id
+ * @return The descriptor of the ring, -1 if none
+ */
+int job_output (int j);
+
+/**
+ * Collect the children that changed state since the last call (SIGCHLD) and
+ * report the jobs among them. Nothing is done when none did
+ * @param redraw If TRUE, a line is being typed: the reports go below it and it
+ * is drawn again
+ * @return Number of jobs reported
+ */
+int reap_jobs (unsigned int redraw);
+
+/**
+ * Report the jobs as soon as they change state while the event loop waits
+ * (when reading a line)
+ * @param on TRUE to start, FALSE to stop
+ */
+void watch_jobs (unsigned int on);
+
+/**
+ * Tell whether one more background job may run (cf. jobs.max)
+ * @return TRUE if fewer jobs than jobs.max are running (or there is no limit)
+ */
+unsigned int job_slot_free (void);
+
+/**
+ * Add a background job that waits for a slot instead of running: it is
+ * started by admit_jobs
+ * @param ptr Command to queue
+ */
+void queue_job (command *ptr);
+
+/**
+ * Start a queued job at once, whatever jobs.max says
+ * @param ptr The queued job, removed if it cannot be started
+ * @return TRUE if it was started
+ */
+unsigned int launch_job (job *ptr);
+
+/**
+ * Start queued jobs while there are free slots, in the order set by
+ * jobs.order
+ * @return Number of jobs started
+ */
+int admit_jobs (void);
+
+/**
+ * Wait for running jobs to end until a queued job, or every one, started
+ * @param j Job id of the queued job, 0 for all of them
+ */
+void flush_queue (int j);
+
+/**
+ * waitpid for a foreground command, the event loop being served meanwhile
+ * when it has to (cf. jobs.throttle)
+ * @param pid PID of the command
+ * @param status Receives the status of the command
+ * @param options Options of waitpid
+ * @return What waitpid returned
+ */
+pid_t wait_foreground (pid_t pid, int *status, int options);
+
+/**
+ * Add a background job started once other jobs ended (cf. after): it is
+ * queued until then
+ * @param ptr Command of the job
+ * @param deps Jobs to wait for, running or queued
+ * @param nb Number of jobs to wait for
+ * @param on_success If TRUE, the job is cancelled unless they all return 0
+ */
+void after_job (command *ptr, job **deps, int nb, unsigned int on_success);
+
+/**
+ * Make a queued job wait for more jobs
+ * @param ptr The queued job
+ * @param deps Jobs to wait for
+ * @param nb Number of jobs to wait for
+ * @param on_success If TRUE, the job is cancelled unless they all return 0
+ * @return 0 on success, -1 if one of them waits for the job (a cycle)
+ */
+int add_deps (job *ptr, job **deps, int nb, unsigned int on_success);
+
+/**
+ * Tell the jobs waiting for a command that left the list to run in
+ * foreground (cf. fg) that it ended
+ * @param pid PID of the command
+ * @param status Its status as returned by waitpid
+ */
+void job_exited (pid_t pid, int status);
+
+/**
+ * Keep the other jobs in the list while it is walked: the jobs a job that
+ * ends releases (cf. after) are only started or cancelled by release_jobs.
+ * Only the job that ended leaves the list meanwhile
+ */
+void hold_jobs (void);
+
+/* Start or cancel the jobs released while the list was held */
+void release_jobs (void);
+
+/**
+ * Get the status of the last job that ended with an id, without forgetting it
+ * @param j Job id
+ * @param status Receives the status of the job as returned by waitpid
+ * @return TRUE if such a job is known
+ */
+unsigned int ended_job_status (int j, int *status);
+
+/**
+ * Return the number of jobs waiting for a slot
+ * @return The number of queued jobs
  */
-void remove_job (int i);
+int nb_queued_jobs (void);
 
 #endif
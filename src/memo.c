@@ -0,0 +1,394 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "memo.h"
+#include "options.h"
+#include "xutils.h"
+
+#define MEMO_MAGIC "SDMEMO1"
+#define MEMO_CHUNK (64 * 1024)
+
+/* Header of an entry of the store, followed by the key and the outputs */
+typedef struct {
+    char magic[8];
+    int status;
+    unsigned int key_len;
+    unsigned long long out_len;
+    unsigned long long err_len;
+} memo_header;
+
+/* Entry of the store considered for eviction */
+typedef struct {
+    char *name;
+    off_t size;
+    time_t used;
+} memo_entry;
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} memo_buf;
+
+static void
+key_add (memo_buf *key, const char *str)
+{
+    size_t len = xstrlen (str) + 1;
+    if (key->len + len > key->size)
+    {
+        key->size = (key->len + len) * 2;
+        key->buf = xrealloc (key->buf, key->size);
+    }
+    memcpy (key->buf + key->len, str != NULL ? str : "", len);
+    key->len += len;
+}
+
+static void
+key_add_var (memo_buf *key, const char *name, size_t n)
+{
+    char var[BUF];
+    char *value;
+    snprintf (var, sizeof (var), "%.*s", (int) n, name);
+    value = getenv (var);
+    key_add (key, var);
+    /* an unset variable differs from an empty one */
+    key_add (key, value != NULL ? "=" : "!");
+    key_add (key, value);
+}
+
+char *
+memo_key (int argc, char **argv, char **vars, int nb_vars,
+          char **inputs, int nb_inputs, size_t *len)
+{
+    memo_buf key = {NULL, 0, 0};
+    const char *env = get_option ("memo.env");
+    char *cwd = getcwd (NULL, 0);
+    char buf[BUF];
+    int i;
+    key_add (&key, "argv");
+    for (i = 0; i < argc; i++)
+        key_add (&key, argv[i]);
+    key_add (&key, "cwd");
+    key_add (&key, cwd);
+    free (cwd);
+    key_add (&key, "env");
+    while (env != NULL && *env != '\0')
+    {
+        const char *end = strchr (env, ',');
+        size_t n = end != NULL ? (size_t) (end - env) : xstrlen (env);
+        if (n > 0)
+            key_add_var (&key, env, n);
+        env = end != NULL ? end + 1 : NULL;
+    }
+    for (i = 0; i < nb_vars; i++)
+        key_add_var (&key, vars[i], xstrlen (vars[i]));
+    key_add (&key, "inputs");
+    for (i = 0; i < nb_inputs; i++)
+    {
+        struct stat st;
+        key_add (&key, inputs[i]);
+        if (stat (inputs[i], &st) != 0)
+            snprintf (buf, sizeof (buf), "-");
+        else
+            snprintf (buf, sizeof (buf), "%llu:%llu:%lld:%ld.%09ld",
+                      (unsigned long long) st.st_dev,
+                      (unsigned long long) st.st_ino,
+                      (long long) st.st_size,
+                      (long) st.st_mtim.tv_sec,
+                      (long) st.st_mtim.tv_nsec);
+        key_add (&key, buf);
+    }
+    *len = key.len;
+    return key.buf;
+}
+
+/* Create a directory and its parents */
+static int
+make_dirs (char *path)
+{
+    char *p;
+    for (p = path + 1; *p != '\0'; p++)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir (path, S_IRWXU) != 0 && errno != EEXIST)
+        {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+    if (mkdir (path, S_IRWXU) != 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+/* Get (and create) the directory of the store */
+static char *
+store_dir (void)
+{
+    const char *dir = get_option ("memo.dir");
+    char *ret;
+    if (xstrlen (dir) > 0)
+        ret = xstrdup (dir);
+    else
+    {
+        const char *base = getenv ("XDG_CACHE_HOME");
+        const char *sub = "/shelldone/memo";
+        if (base == NULL || *base == '\0')
+        {
+            base = getenv ("HOME");
+            sub = "/.cache/shelldone/memo";
+        }
+        if (base == NULL || *base == '\0')
+            return NULL;
+        ret = xmalloc (xstrlen (base) + xstrlen (sub) + 1);
+        sprintf (ret, "%s%s", base, sub);
+    }
+    if (make_dirs (ret) != 0)
+    {
+        xfree (ret);
+        return NULL;
+    }
+    return ret;
+}
+
+/* Path of the entry of the given key (FNV-1a hash of the key) */
+static char *
+entry_path (const char *dir, const char *key, size_t len)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    size_t i;
+    char *ret = xmalloc (xstrlen (dir) + 18);
+    for (i = 0; i < len; i++)
+    {
+        h ^= (unsigned char) key[i];
+        h *= 1099511628211ULL;
+    }
+    sprintf (ret, "%s/%016llx", dir, h);
+    return ret;
+}
+
+/* Copy len bytes of 'from' starting at off to 'to' */
+static int
+copy_range (int from, off_t off, size_t len, int to)
+{
+    char buf[MEMO_CHUNK];
+    ssize_t r = 0;
+    while (len > 0)
+    {
+        r = sendfile (to, from, &off, len < MEMO_CHUNK ? len : MEMO_CHUNK);
+        if (r <= 0)
+            break;
+        len -= r;
+    }
+    if (len == 0)
+        return 0;
+    if (r < 0 && errno != EINVAL && errno != ENOSYS)
+        return -1;
+    while (len > 0)
+    {
+        r = pread (from, buf, len < sizeof (buf) ? len : sizeof (buf), off);
+        if (r <= 0 || xwrite (to, buf, r) < 0)
+            return -1;
+        off += r;
+        len -= r;
+    }
+    return 0;
+}
+
+int
+memo_replay (const char *key, size_t len, int out, int err)
+{
+    char *dir = store_dir (), *path, *stored = NULL;
+    memo_header h;
+    int fd, ret = -1;
+    if (dir == NULL)
+        return -1;
+    path = entry_path (dir, key, len);
+    fd = open (path, O_RDONLY|O_CLOEXEC);
+    xfree (path);
+    xfree (dir);
+    if (fd < 0)
+        return -1;
+    if (read (fd, &h, sizeof (h)) != sizeof (h) ||
+        memcmp (h.magic, MEMO_MAGIC, sizeof (h.magic)) != 0 ||
+        h.key_len != len)
+        goto end;
+    /* a different key with the same hash is a miss */
+    stored = xmalloc (len);
+    if (read (fd, stored, len) != (ssize_t) len || 
+        memcmp (stored, key, len) != 0)
+        goto end;
+    if (copy_range (fd, sizeof (h) + len, h.out_len, out) != 0 ||
+        copy_range (fd, sizeof (h) + len + h.out_len, h.err_len, err) != 0)
+        goto end;
+    /* the modification time of an entry tells when it was last used */
+    futimens (fd, NULL);
+    ret = h.status;
+end:
+    xfree (stored);
+    close (fd);
+    return ret;
+}
+
+int
+memo_spool (void)
+{
+    char path[] = "/tmp/shelldone-XXXXXX";
+    int fd = mkstemp (path);
+    if (fd >= 0)
+        unlink (path);
+    return fd;
+}
+
+int
+memo_unspool (int fd, int out)
+{
+    struct stat st;
+    if (fstat (fd, &st) != 0)
+        return -1;
+    return copy_range (fd, 0, st.st_size, out);
+}
+
+static int
+cmp_entries (const void *p1, const void *p2)
+{
+    const memo_entry *e1 = p1, *e2 = p2;
+    return (e1->used > e2->used) - (e1->used < e2->used);
+}
+
+/* Remove the least recently used entries until the store fits in limit */
+static void
+evict (const char *dir, long long limit)
+{
+    DIR *d = opendir (dir);
+    struct dirent *ent;
+    memo_entry *entries = NULL;
+    long long total = 0;
+    int nb = 0, i;
+    char path[BUF * 4];
+    if (d == NULL)
+        return;
+    while ((ent = readdir (d)) != NULL)
+    {
+        struct stat st;
+        /* skip '.', '..' and the entries being written */
+        if (ent->d_name[0] == '.')
+            continue;
+        snprintf (path, sizeof (path), "%s/%s", dir, ent->d_name);
+        if (stat (path, &st) != 0 || !S_ISREG (st.st_mode))
+            continue;
+        entries = xrealloc (entries, (nb + 1) * sizeof (memo_entry));
+        entries[nb].name = xstrdup (ent->d_name);
+        entries[nb].size = st.st_size;
+        entries[nb].used = st.st_mtime;
+        total += st.st_size;
+        nb++;
+    }
+    closedir (d);
+    if (total > limit)
+        qsort (entries, nb, sizeof (memo_entry), cmp_entries);
+    for (i = 0; i < nb; i++)
+    {
+        if (total > limit)
+        {
+            snprintf (path, sizeof (path), "%s/%s", dir, entries[i].name);
+            if (unlink (path) == 0)
+                total -= entries[i].size;
+        }
+        xfree (entries[i].name);
+    }
+    xfree (entries);
+}
+
+int
+memo_store (const char *key, size_t len, int out, int err, int status)
+{
+    struct stat so, se;
+    memo_header h;
+    long long limit = get_option_int ("memo.size");
+    char *dir, *path, *tmp;
+    int fd, ret = 0;
+    if (fstat (out, &so) != 0 || fstat (err, &se) != 0)
+        return -1;
+    if ((long long) (sizeof (h) + len + so.st_size + se.st_size) > limit ||
+        (dir = store_dir ()) == NULL)
+        return -1;
+    tmp = xmalloc (xstrlen (dir) + 14);
+    sprintf (tmp, "%s/.tmp-XXXXXX", dir);
+    if ((fd = mkstemp (tmp)) < 0)
+    {
+        xfree (tmp);
+        xfree (dir);
+        return -1;
+    }
+    memset (&h, 0, sizeof (h));
+    memcpy (h.magic, MEMO_MAGIC, sizeof (h.magic));
+    h.status = status;
+    h.key_len = len;
+    h.out_len = so.st_size;
+    h.err_len = se.st_size;
+    path = entry_path (dir, key, len);
+    /* the entry only shows up once complete */
+    if (xwrite (fd, &h, sizeof (h)) != 0 || xwrite (fd, key, len) != 0 ||
+        copy_range (out, 0, so.st_size, fd) != 0 ||
+        copy_range (err, 0, se.st_size, fd) != 0 ||
+        rename (tmp, path) != 0)
+    {
+        unlink (tmp);
+        ret = -1;
+    }
+    else
+        evict (dir, limit);
+    close (fd);
+    xfree (path);
+    xfree (tmp);
+    xfree (dir);
+    return ret;
+}
@@ -0,0 +1,91 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _MEMO_H_
+#define _MEMO_H_
+
+#include <stddef.h>
+
+/**
+ * Build the key identifying a run of a command: its arguments, the current
+ * directory, the given environment variables (and the ones listed in the
+ * 'memo.env' option) and the size and modification time of its inputs
+ * @param argc Number of arguments (command included)
+ * @param argv Arguments (command included)
+ * @param vars Names of the environment variables the command depends on
+ * @param nb_vars Number of variables
+ * @param inputs Files the command reads
+ * @param nb_inputs Number of files
+ * @param len Receives the length of the key
+ * @return A new allocated key
+ */
+char *memo_key (int argc, char **argv, char **vars, int nb_vars,
+                char **inputs, int nb_inputs, size_t *len);
+
+/**
+ * Replay the outputs of a previous run with the same key
+ * @param key Key of the run
+ * @param len Length of the key
+ * @param out Descriptor receiving the standard output of the run
+ * @param err Descriptor receiving the standard error output of the run
+ * @return The exit status of the run, -1 if it is not in the store
+ */
+int memo_replay (const char *key, size_t len, int out, int err);
+
+/**
+ * Create an anonymous file where the outputs of a run are captured
+ * @return Descriptor of the file, -1 on error
+ */
+int memo_spool (void);
+
+/**
+ * Save a run in the store, evicting the least recently used runs if the
+ * store gets bigger than the 'memo.size' option
+ * @param key Key of the run
+ * @param len Length of the key
+ * @param out Spool containing the standard output of the run
+ * @param err Spool containing the standard error output of the run
+ * @param status Exit status of the run
+ * @return 0 on success, -1 if the run was not saved
+ */
+int memo_store (const char *key, size_t len, int out, int err, int status);
+
+/**
+ * Copy the whole content of a spool to the given descriptor
+ * @param fd Spool to copy
+ * @param out Destination
+ * @return 0 on success, -1 on error
+ */
+int memo_unspool (int fd, int out);
+
+#endif
@@ -0,0 +1,199 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+
+#include "meter.h"
+#include "pipeline.h"
+#include "xutils.h"
+
+#define METER_CHUNK (1024 * 1024)
+
+static unsigned long long
+now (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+meter_stats *
+meter_alloc (int nb)
+{
+    meter_stats *st = mmap (NULL, nb * sizeof (meter_stats),
+                            PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+                            -1, 0);
+    return st == MAP_FAILED ? NULL : st;
+}
+
+void
+meter_free (meter_stats *st, int nb)
+{
+    if (st != NULL)
+        munmap (st, nb * sizeof (meter_stats));
+}
+
+/* 
+ * The pages move from one pipe to the other without a copy. When splice
+ * cannot go on, the meter waits for the end that is not ready and charges
+ * the time to it
+ */
+static void
+meter_run (int in, int out, meter_stats *st)
+{
+    int size;
+    st->start = now ();
+    /* fewer and bigger moves: the meter must not slow the line down */
+    fcntl (in, F_SETPIPE_SZ, METER_CHUNK);
+    fcntl (out, F_SETPIPE_SZ, METER_CHUNK);
+    size = fcntl (out, F_GETPIPE_SZ);
+    while (1)
+    {
+        ssize_t r = splice (in, NULL, out, NULL, METER_CHUNK,
+                            SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        struct pollfd p[2] = {{in, POLLIN, 0}, {out, POLLOUT, 0}};
+        struct timespec pause = {0, 1000000};
+        unsigned long long t;
+        int queued;
+        if (r > 0)
+        {
+            st->bytes += r;
+            continue;
+        }
+        if (r == 0 || (errno != EAGAIN && errno != EINTR))
+            break;
+        if (errno == EINTR)
+            continue;
+        t = now ();
+        if (poll (p, 1, 0) == 0)
+        {
+            poll (p, 1, -1);
+            st->starved += now () - t;
+        }
+        else
+        {
+            poll (p + 1, 1, -1);
+            /* the reader is gone */
+            if (p[1].revents & POLLERR)
+                break;
+            /* 
+             * a slow reader frees a few pages at a time: moving them one
+             * wakeup at a time would cost more than the reader itself
+             */
+            while (ioctl (out, FIONREAD, &queued) == 0 && 
+                   queued > size - size / 4)
+                nanosleep (&pause, NULL);
+            st->full += now () - t;
+        }
+    }
+    st->end = now ();
+}
+
+pid_t
+meter_start (int in, int out, meter_stats *st)
+{
+    int keep[2] = {in, out};
+    pid_t r;
+    memset (st, 0, sizeof (meter_stats));
+    r = fork_helper (keep, 2);
+    if (r == 0)
+    {
+        /* the writer gets SIGPIPE when the meter closes its end */
+        signal (SIGPIPE, SIG_IGN);
+        meter_run (in, out, st);
+        _exit (0);
+    }
+    return r;
+}
+
+/* Format a size like pv does */
+static void
+format_size (char *buf, size_t len, double size, const char *suffix)
+{
+    const char *units = "BKMGT";
+    while (size >= 1024 && units[1] != '\0')
+    {
+        size /= 1024;
+        units++;
+    }
+    if (*units == 'B')
+        snprintf (buf, len, "%.0fB%s", size, suffix);
+    else
+        snprintf (buf, len, "%.2f%ciB%s", size, *units, suffix);
+}
+
+void
+meter_report (FILE *out, const meter_stats *st, char **names, int nb)
+{
+    int i;
+    fprintf (out, "%-16s %11s %11s %13s %10s %10s\n", "stage", "in", "out",
+             "rate", "read-wait", "write-wait");
+    for (i = 0; i < nb; i++)
+    {
+        /* a stage reads the pipe before it and writes the one after it */
+        const meter_stats *in = i > 0 ? &st[i - 1] : NULL;
+        const meter_stats *o = i < nb - 1 ? &st[i] : NULL;
+        const meter_stats *r = in != NULL ? in : o;
+        char name[32], bin[32] = "-", bout[32] = "-", rate[32] = "-";
+        char rwait[32] = "-", wwait[32] = "-";
+        snprintf (name, sizeof (name), "%d %s", i + 1, names[i]);
+        if (in != NULL)
+        {
+            format_size (bin, sizeof (bin), in->bytes, "");
+            snprintf (rwait, sizeof (rwait), "%.3fs", in->starved / 1e9);
+        }
+        if (o != NULL)
+        {
+            format_size (bout, sizeof (bout), o->bytes, "");
+            snprintf (wwait, sizeof (wwait), "%.3fs", o->full / 1e9);
+        }
+        if (r != NULL && r->end > r->start)
+            format_size (rate, sizeof (rate),
+                         r->bytes / ((r->end - r->start) / 1e9), "/s");
+        fprintf (out, "%-16s %11s %11s %13s %10s %10s\n", name, bin, bout,
+                 rate, rwait, wwait);
+    }
+}
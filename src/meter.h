@@ -0,0 +1,87 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _METER_H_
+#define _METER_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* What a meter saw on the pipe between two stages */
+typedef struct {
+    /* bytes moved */
+    unsigned long long bytes;
+    /* when the meter started and saw the end of the data (ns) */
+    unsigned long long start;
+    unsigned long long end;
+    /* time waiting for the writer: the reader would have blocked on read */
+    unsigned long long starved;
+    /* time waiting for the reader: the writer would have blocked on write */
+    unsigned long long full;
+} meter_stats;
+
+/**
+ * Allocate the stats of the meters of a line, shared with the meters
+ * @param nb Number of meters
+ * @return The stats or NULL on error
+ */
+meter_stats *meter_alloc (int nb);
+
+/**
+ * Release the stats of the meters of a line
+ * @param st Stats to free
+ * @param nb Number of meters
+ */
+void meter_free (meter_stats *st, int nb);
+
+/**
+ * Fork a process moving the data from 'in' to 'out' with splice(2) and
+ * recording how much went through and which side it waited for
+ * @param in Read end of the pipe of the writer
+ * @param out Write end of the pipe of the reader
+ * @param st Where to record the stats
+ * @return The pid of the meter, -1 on error
+ */
+pid_t meter_start (int in, int out, meter_stats *st);
+
+/**
+ * Print a pv-like summary of a line: for each stage its input, output and
+ * rate, and the time it spent blocked on read and on write
+ * @param out Stream to write to
+ * @param st Stats of the nb - 1 pipes
+ * @param names Commands of the stages
+ * @param nb Number of stages
+ */
+void meter_report (FILE *out, const meter_stats *st, char **names, int nb);
+
+#endif
@@ -0,0 +1,242 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+
+#include "onchange.h"
+#include "command.h"
+#include "options.h"
+#include "xutils.h"
+#include "evloop.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE|IN_MODIFY|IN_ATTRIB|IN_CREATE|IN_DELETE|\
+                      IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF)
+
+/* paths of the watched directories indexed by watch descriptor */
+static char **watched = NULL;
+static int nb_watched = 0;
+static volatile sig_atomic_t stop = FALSE;
+
+static void
+stophandler (int sig)
+{
+    stop = TRUE;
+    (void) sig;
+}
+
+/* Watch a file, or a directory and its subdirectories */
+static int
+add_watches (int fd, const char *path)
+{
+    struct stat st;
+    DIR *d;
+    struct dirent *ent;
+    int wd;
+    if (lstat (path, &st) != 0)
+        return -1;
+    if ((wd = inotify_add_watch (fd, path, WATCH_EVENTS)) < 0)
+        return -1;
+    if (wd >= nb_watched)
+    {
+        watched = xrealloc (watched, (wd + 1) * sizeof (char *));
+        memset (watched + nb_watched, 0, 
+                (wd + 1 - nb_watched) * sizeof (char *));
+        nb_watched = wd + 1;
+    }
+    if (!S_ISDIR (st.st_mode) || watched[wd] != NULL)
+        return 0;
+    watched[wd] = xstrdup (path);
+    if ((d = opendir (path)) == NULL)
+        return 0;
+    while ((ent = readdir (d)) != NULL)
+    {
+        char *sub;
+        if (xstrcmp (ent->d_name, ".") == 0 || xstrcmp (ent->d_name, "..") == 0)
+            continue;
+        if (ent->d_type != DT_DIR && ent->d_type != DT_UNKNOWN)
+            continue;
+        sub = xmalloc (xstrlen (path) + xstrlen (ent->d_name) + 2);
+        sprintf (sub, "%s/%s", path, ent->d_name);
+        if (lstat (sub, &st) == 0 && S_ISDIR (st.st_mode))
+            add_watches (fd, sub);
+        xfree (sub);
+    }
+    closedir (d);
+    return 0;
+}
+
+/**
+ * Read the pending events, watching the new directories
+ * @return The number of events read
+ */
+static int
+read_events (int fd)
+{
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    ssize_t len;
+    int nb = 0;
+    while ((len = read (fd, buf, sizeof (buf))) > 0)
+    {
+        char *p;
+        for (p = buf; p < buf + len; 
+             p += sizeof (struct inotify_event) + 
+                  ((struct inotify_event *) p)->len)
+        {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            nb++;
+            if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE|IN_MOVED_TO)) &&
+                ev->wd < nb_watched && watched[ev->wd] != NULL)
+            {
+                char *sub = xmalloc (xstrlen (watched[ev->wd]) + ev->len + 2);
+                sprintf (sub, "%s/%s", watched[ev->wd], ev->name);
+                add_watches (fd, sub);
+                xfree (sub);
+            }
+        }
+    }
+    return nb;
+}
+
+/* Wait for the end of the current run, cancelling it first if asked */
+static void
+end_run (pid_t *pid, int *pidfd, unsigned int cancel)
+{
+    if (*pid <= 0)
+        return;
+    if (cancel)
+        kill (*pid, SIGTERM);
+    waitpid (*pid, NULL, 0);
+    if (*pidfd >= 0)
+    {
+        evloop_del (*pidfd);
+        close (*pidfd);
+    }
+    *pid = -1;
+    *pidfd = -1;
+}
+
+static void
+start_run (int argc, char **argv, pid_t *pid, int *pidfd)
+{
+    command_line *cl = run_argv (argc, argv, STDIN_FILENO, STDOUT_FILENO,
+                                 STDERR_FILENO);
+    *pid = cl->content->builtin ? -1 : cl->content->pid;
+    *pidfd = -1;
+    if (*pid > 0)
+        *pidfd = syscall (SYS_pidfd_open, *pid, 0);
+    if (*pidfd >= 0 && evloop_add (*pidfd, NULL, NULL) != 0)
+    {
+        close (*pidfd);
+        *pidfd = -1;
+    }
+    free_cmd_line (cl);
+}
+
+int
+onchange (char **paths, int nb, int argc, char **argv)
+{
+    struct sigaction sa;
+    int fd = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC), i, pidfd = -1;
+    int delay = xmax (get_option_int ("onchange.delay"), 0);
+    pid_t pid = -1;
+    if (fd < 0)
+        return -1;
+    for (i = 0; i < nb; i++)
+    {
+        if (add_watches (fd, paths[i]) != 0)
+        {
+            fprintf (stderr, "onchange: %s: %s\n", paths[i], strerror (errno));
+            close (fd);
+            return -1;
+        }
+    }
+    /* a termination request must interrupt the wait and cancel the run */
+    sa.sa_handler = stophandler;
+    sigemptyset (&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction (SIGTERM, &sa, NULL);
+    sigaction (SIGHUP, &sa, NULL);
+    sigaction (SIGINT, &sa, NULL);
+    evloop_add (fd, NULL, NULL);
+    start_run (argc, argv, &pid, &pidfd);
+    while (!stop)
+    {
+        /* without pidfd, check the end of the run from time to time */
+        int r = evloop_wait (pid > 0 && pidfd < 0 ? 100 : -1);
+        if (r < 0 && errno != EINTR && errno != ETIME)
+            break;
+        if (pid > 0 && (pidfd >= 0 ? r == pidfd :
+                                     waitpid (pid, NULL, WNOHANG) == pid))
+            end_run (&pid, &pidfd, FALSE);
+        if (r != fd)
+            continue;
+        /* gather the burst: wait until nothing changes for 'delay' ms */
+        read_events (fd);
+        while (!stop && ((r = evloop_wait (delay)) >= 0 || errno == EINTR))
+        {
+            if (r < 0)
+                continue;
+            if (r == pidfd)
+                end_run (&pid, &pidfd, FALSE);
+            else if (read_events (fd) == 0)
+                break;
+        }
+        if (stop)
+            break;
+        end_run (&pid, &pidfd, TRUE);
+        start_run (argc, argv, &pid, &pidfd);
+    }
+    end_run (&pid, &pidfd, TRUE);
+    for (i = 0; i < nb_watched; i++)
+        xfree (watched[i]);
+    xfree (watched);
+    watched = NULL;
+    nb_watched = 0;
+    evloop_del (fd);
+    close (fd);
+    return 0;
+}
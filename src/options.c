@@ -0,0 +1,237 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "options.h"
+#include "xutils.h"
+
+static unsigned int check_affinity (const char *value);
+
+static option options[] = {
+    {"shard.split", OPT_CHOICE, "rr", "rr|hash", NULL,
+     "how '|N>' dispatches the lines between the copies", NULL},
+    {"shard.key", OPT_INT, "0", NULL, NULL,
+     "field hashed when shard.split is 'hash' (0: whole line)", NULL},
+    {"shard.merge", OPT_CHOICE, "unordered", "unordered|grouped", NULL,
+     "how the outputs of the copies are merged (never in input order)", NULL},
+    {"pipe.size", OPT_SIZE, "0", NULL, NULL,
+     "buffer size of the pipes of a line (0: kernel default)", NULL},
+    {"pipe.affinity", OPT_STRING, "none", NULL, check_affinity,
+     "pin the commands of a line: none|compact|spread|<cpu list>", NULL},
+    {"pipe.stats", OPT_CHOICE, "off", "off|on", NULL,
+     "print what went through each pipe of a line and who waited", NULL},
+    {"memo.dir", OPT_STRING, "", NULL, NULL,
+     "store of 'memo' (empty: ~/.cache/shelldone/memo)", NULL},
+    {"memo.size", OPT_SIZE, "64M", NULL, NULL,
+     "size limit of the 'memo' store", NULL},
+    {"memo.env", OPT_STRING, "", NULL, NULL,
+     "',' separated variables 'memo' always hashes", NULL},
+    {"trace", OPT_CHOICE, "off", "off|on", NULL,
+     "record what the shell runs (cf. set -x and trace)", NULL},
+    {"trace.size", OPT_SIZE, "1M", NULL, NULL,
+     "size of the trace ring", NULL},
+    {"trace.file", OPT_STRING, "", NULL, NULL,
+     "file of the trace ring (empty: shelldone-trace-<pid> in "
+     "$XDG_RUNTIME_DIR or /tmp)", NULL},
+    {"onchange.delay", OPT_INT, "100", NULL, NULL,
+     "ms without changes before 'onchange' reruns its command", NULL},
+    {"batch", OPT_CHOICE, "off", "off|on", NULL,
+     "run commands with too many arguments in batches that fit", NULL},
+    {"batch.jobs", OPT_INT, "1", NULL, NULL,
+     "nb of batches running at the same time", NULL},
+    {"loop.backend", OPT_CHOICE, "auto", "auto|io_uring|epoll", NULL,
+     "how the shell waits for the terminal and the jobs", NULL},
+    {"jobs.max", OPT_INT, "0", NULL, NULL,
+     "nb of background jobs running at once, the others wait (0: no limit)",
+     NULL},
+    {"jobs.order", OPT_CHOICE, "fifo", "fifo|nice", NULL,
+     "queued job started first (nice: the lowest 'limit --nice')", NULL},
+    {"jobs.throttle", OPT_CHOICE, "off", "off|on", NULL,
+     "stop the newest background jobs while the system is under pressure",
+     NULL},
+    {"jobs.pressure", OPT_INT, "40", NULL, NULL,
+     "% of time stalled (/proc/pressure) throttling a job (resumed below half)",
+     NULL},
+    {"jobs.capture", OPT_CHOICE, "off", "off|on", NULL,
+     "keep the output of background jobs in memory (cf. jobs output)", NULL},
+    {"jobs.capture.size", OPT_SIZE, "1M", NULL, NULL,
+     "size of the ring keeping the output of each background job", NULL},
+    {NULL, 0, NULL, NULL, NULL, NULL, NULL}
+};
+
+static unsigned int
+check_affinity (const char *value)
+{
+    int size;
+    int *cpus;
+    if (xstrcmp (value, "none") == 0 ||
+        xstrcmp (value, "compact") == 0 ||
+        xstrcmp (value, "spread") == 0)
+        return TRUE;
+    cpus = xstrranges (value, &size);
+    xfree (cpus);
+    return cpus != NULL;
+}
+
+static option *
+find_option (const char *key)
+{
+    int i;
+    for (i = 0; options[i].key != NULL; i++)
+        if (xstrcmp (options[i].key, key) == 0)
+            return &options[i];
+    return NULL;
+}
+
+static unsigned int
+valid_choice (const char *choices, const char *value)
+{
+    size_t len = xstrlen (value);
+    const char *c = choices;
+    while (c != NULL && *c != '\0')
+    {
+        const char *end = strchr (c, '|');
+        size_t s = end != NULL ? (size_t) (end - c) : xstrlen (c);
+        if (s == len && strncmp (c, value, len) == 0)
+            return TRUE;
+        c = end != NULL ? end + 1 : NULL;
+    }
+    return FALSE;
+}
+
+/**
+ * Parse a value of an integer or size option
+ * @return TRUE if the whole string is valid
+ */
+static unsigned int
+parse_number (const option *opt, const char *value, long *res)
+{
+    char *end;
+    if (opt->type == OPT_SIZE)
+    {
+        *res = xstrtosize (value);
+        return *res >= 0;
+    }
+    if (xstrlen (value) == 0)
+        return FALSE;
+    errno = 0;
+    *res = strtol (value, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+void
+init_options (void)
+{
+    int i;
+    xdebug (NULL);
+    for (i = 0; options[i].key != NULL; i++)
+        options[i].value = xstrdup (options[i].def);
+}
+
+void
+clear_options (void)
+{
+    int i;
+    xdebug (NULL);
+    for (i = 0; options[i].key != NULL; i++)
+    {
+        xfree (options[i].value);
+        options[i].value = NULL;
+    }
+}
+
+const char *
+get_option (const char *key)
+{
+    option *opt = find_option (key);
+    if (opt == NULL)
+        return NULL;
+    return opt->value != NULL ? opt->value : "";
+}
+
+long
+get_option_int (const char *key)
+{
+    option *opt = find_option (key);
+    long res;
+    if (opt == NULL || !parse_number (opt, opt->value, &res))
+        return 0;
+    return res;
+}
+
+unsigned int
+option_is (const char *key, const char *value)
+{
+    return xstrcmp (get_option (key), value) == 0;
+}
+
+int
+set_option (const char *key, const char *value)
+{
+    option *opt = find_option (key);
+    if (opt == NULL)
+        return 1;
+    switch (opt->type)
+    {
+    case OPT_INT:
+    case OPT_SIZE:
+    {
+        long res;
+        if (!parse_number (opt, value, &res))
+            return 2;
+        break;
+    }
+    case OPT_CHOICE:
+        if (!valid_choice (opt->choices, value))
+            return 2;
+        break;
+    case OPT_STRING:
+        if (opt->check != NULL && !opt->check (value))
+            return 2;
+        break;
+    }
+    xfree (opt->value);
+    opt->value = xstrdup (value);
+    return 0;
+}
+
+const option *
+get_option_by_index (int i)
+{
+    if (i < 0 || i >= (int) (sizeof (options) / sizeof (options[0])) - 1)
+        return NULL;
+    return &options[i];
+}
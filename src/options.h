@@ -0,0 +1,113 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+
+/* Different kinds of values an option accepts */
+typedef enum {
+    /* a signed integer */
+    OPT_INT = 1,
+    /* one of the values listed in 'choices' */
+    OPT_CHOICE,
+    /* any string */
+    OPT_STRING,
+    /* a size in bytes, optionally suffixed by K, M or G */
+    OPT_SIZE
+} OptType;
+
+/* Structure representing a shell option (cf. the 'set' builtin) */
+typedef struct _option option;
+
+struct _option {
+    /* key */
+    const char *key;
+    /* kind of value */
+    OptType type;
+    /* default value */
+    const char *def;
+    /* '|' separated list of accepted values (OPT_CHOICE only) */
+    const char *choices;
+    /* optional callback validating the values (OPT_STRING only) */
+    unsigned int (*check) (const char *value);
+    /* short description displayed by 'set' */
+    const char *desc;
+    /* current value */
+    char *value;
+};
+
+/* Initialize the options with their default values */
+void init_options (void);
+
+/* Clear the options */
+void clear_options (void);
+
+/**
+ * Get the current value of an option
+ * @param key Name of the option
+ * @return The value of the option or NULL if the option does not exist
+ */
+const char *get_option (const char *key);
+
+/**
+ * Get the current value of an integer (or size) option
+ * @param key Name of the option
+ * @return The value of the option, 0 if it does not exist
+ */
+long get_option_int (const char *key);
+
+/**
+ * Check whether an option is set to the given value
+ * @param key Name of the option
+ * @param value Value to compare with
+ * @return TRUE if the option is set to value
+ */
+unsigned int option_is (const char *key, const char *value);
+
+/**
+ * Change the value of an option
+ * @param key Name of the option
+ * @param value New value
+ * @return 0 on success, 1 if the option does not exist, 2 if the value is
+ * invalid
+ */
+int set_option (const char *key, const char *value);
+
+/**
+ * Get the option at the given index (used to list them)
+ * @param i Index of the option
+ * @return The option or NULL if i is out of range
+ */
+const option *get_option_by_index (int i);
+
+#endif
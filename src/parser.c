@@ -57,12 +57,15 @@
 #include "caps.h"
 #include "list.h"
 #include "modules.h"
+#include "trace.h"
+#include "rlimits.h"
+#include "evloop.h"
 
 #define reset_completion() completion (NULL, NULL, NULL)
 
 #define sh_read(fileno,buf,size) do{\
 interrupted = FALSE;\
-read (fileno,buf,size);\
+while (evloop_read (fileno,buf,size) < 0 && errno == EINTR && !interrupted);\
 if (interrupted)\
 {\
     goto exit;\
@@ -75,6 +78,10 @@ static int last_history = 0, curr_history;
 static char **command_list = NULL;
 static int nb_commands = 0;
 static struct termios in_save;
+/* the line being read (cf. redraw_line) */
+static const char *edit_prompt = NULL;
+static char **edit_line = NULL;
+static int *edit_len = NULL;
 
 extern unsigned int interrupted;
 extern pid_t shell_pgid;
@@ -87,6 +94,7 @@ static void clear_ioctl (void);
 static char *completion (const char *prompt, char *buf, int *ind);
 static int cmpsort (const void *p1, const void *p2);
 static int reg_filter (const struct dirent *p);
+static void redirect_output (command *ptr, int fd, int desc);
 static char get_char (const char input[5],
                       const char *prompt,
                       char **ret,
@@ -107,6 +115,36 @@ static char *parse_exe (char **split,
                         const char *prompt,
                         int *cpt);
 
+/**
+ * Redirect the given output of a command to a file. If the output is already
+ * redirected to a file, the new one is added to its targets (ie. cmd >a >b)
+ * @param ptr Command to redirect
+ * @param fd Output to redirect (STDOUT_FILENO or STDERR_FILENO)
+ * @param desc Descriptor of the file
+ */
+static void
+redirect_output (command *ptr, int fd, int desc)
+{
+    int *target = fd == STDERR_FILENO ? &ptr->err : &ptr->out;
+    if (*target > STDERR_FILENO)
+    {
+        if (fd == STDERR_FILENO)
+        {
+            ptr->errs = xrealloc (ptr->errs, 
+                                  (ptr->nb_errs + 1) * sizeof (int));
+            ptr->errs[ptr->nb_errs++] = desc;
+        }
+        else
+        {
+            ptr->outs = xrealloc (ptr->outs, 
+                                  (ptr->nb_outs + 1) * sizeof (int));
+            ptr->outs[ptr->nb_outs++] = desc;
+        }
+    }
+    else
+        *target = desc;
+}
+
 static int
 cmpsort (const void *p1, const void *p2)
 {
@@ -837,9 +875,10 @@ parse_line (const char *l)
     size_t size = xstrlen (l);
     int new_word = 0, first = 1, new_command = 0, begin = 1, i = 0, factor = 1,
         factor2 = 1, arg = 0, squote = 0, dquote = 0, bracket = 0,
-        backquote = 0;
+        backquote = 0, shards = 1;
     command_line *curr = NULL;
     i = 0;
+    trace_parse (l);
     /* let's create the line container */
     ret = xmalloc (sizeof (*ret));
     if (ret == NULL)
@@ -1051,19 +1090,7 @@ parse_line (const char *l)
             if (read)
                 curr->content->in = desc;
             else
-            {
-                switch (fd)
-                {
-                case STDOUT_FILENO:
-                    curr->content->out = desc;
-                    break;
-                case STDERR_FILENO:
-                    curr->content->err = desc;
-                    break;
-                default:
-                    curr->content->out = desc;
-                }
-            }
+                redirect_output (curr->content, fd, desc);
             xfree (file);
             continue;
         }
@@ -1091,7 +1118,28 @@ parse_line (const char *l)
                     curr->content->flag = OR;
                 }
                 else
+                {
                     curr->content->flag = PIPE;
+                    /* '|N>' runs N copies of the next command */
+                    if (cpt < size && isdigit (l[cpt]))
+                    {
+                        size_t e = cpt;
+                        while (e < size && isdigit (l[e]))
+                            e++;
+                        if (e < size && l[e] == '>')
+                        {
+                            shards = strtol (l + cpt, NULL, 10);
+                            if (shards < 1)
+                            {
+                                syntax_error (l, size, cpt);
+                                free_cmd_line (curr);
+                                free_line (ret);
+                                return NULL;
+                            }
+                            cpt = e + 1;
+                        }
+                    }
+                }
                 break;
             case ';':
                 curr->content->flag = END;
@@ -1129,6 +1177,8 @@ parse_line (const char *l)
                 free_line (ret);
                 return NULL;
             }
+            curr->content->shards = shards;
+            shards = 1;
         }
         if (begin && !new_word)
         {
@@ -1242,6 +1292,15 @@ parse_line (const char *l)
         list_append ((sdlist **)&ret, (sddata *)curr);
     else
         free_cmd_line (curr);
+    /* the 'limit' prefix only leaves its settings on the command */
+    for (curr = ret->head; curr != NULL; curr = curr->next)
+    {
+        if (parse_limits (curr->content) != 0)
+        {
+            free_line (ret);
+            return NULL;
+        }
+    }
     return ret;
 }
 
@@ -1377,6 +1436,17 @@ get_char (const char input[5],
     return -1;
 }
 
+void
+redraw_line (void)
+{
+    if (edit_line == NULL)
+        return;
+    fprintf (stdout, "%s%.*s", edit_prompt != NULL ? edit_prompt : "",
+                               *edit_len,
+                               *edit_line);
+    fflush (stdout);
+}
+
 char *
 read_line (const char *prompt)
 {
@@ -1393,6 +1463,9 @@ read_line (const char *prompt)
         fprintf (stdout, "%s", prompt);
         fflush (stdout);
     }
+    edit_prompt = prompt;
+    edit_line = &ret;
+    edit_len = &cpt;
     init_ioctl ();
     do
     {
@@ -1481,6 +1554,7 @@ replay:
             char *new = xrealloc (ret, ind * BUF * sizeof (char));
             if (new == NULL)
             {
+                edit_line = NULL;
                 xfree (ret);
                 return NULL;
             }
@@ -1507,6 +1581,7 @@ replay:
     }
     fprintf (stdout, "\n");
 exit:
+    edit_line = NULL;
     if (cpt >= ind * BUF)
     {
         char *new = xrealloc (ret, (ind * BUF * sizeof (char)) + 1);
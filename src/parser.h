@@ -69,6 +69,12 @@ input_line *parse_line (const char *line);
  */
 char *read_line (const char *prompt);
 
+/**
+ * Draw again the prompt and the line being read, after something was printed
+ * over it. Nothing happens when no line is being read
+ */
+void redraw_line (void);
+
 /**
  * Built a list of available commands
  */
@@ -0,0 +1,686 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+
+#include "pipeline.h"
+#include "evloop.h"
+#include "jobs.h"
+#include "options.h"
+#include "xutils.h"
+
+/* amount of data handed to a copy (or moved by splice) at once */
+#define SHARD_CHUNK (64 * 1024)
+
+#define SYSCPU "/sys/devices/system/cpu"
+
+/* Where a CPU sits in the machine */
+typedef struct {
+    int cpu;
+    /* socket */
+    int pkg;
+    /* core inside the socket */
+    int core;
+    /* hardware thread inside the core */
+    int smt;
+} cpu_topo;
+
+/* the CPUs we are allowed to run on, and how many of them */
+static cpu_topo *topology = NULL;
+static int nb_cpus = -1;
+
+/* Largest pipe size an unprivileged process may ask for */
+static long
+pipe_max_size (void)
+{
+    static long max = 0;
+    if (max == 0)
+    {
+        FILE *f = fopen ("/proc/sys/fs/pipe-max-size", "r");
+        if (f == NULL || fscanf (f, "%ld", &max) != 1)
+            max = -1;
+        if (f != NULL)
+            fclose (f);
+    }
+    return max;
+}
+
+int
+new_pipe (int fd[2])
+{
+    long size = get_option_int ("pipe.size");
+    if (pipe2 (fd, O_CLOEXEC) == -1)
+        return -1;
+    if (size > 0)
+    {
+        long max = pipe_max_size ();
+        if (max > 0 && size > max)
+            size = max;
+        /* 
+         * the kernel rounds the size up to a power of two number of pages. If
+         * it refuses (ie. the user exceeded its pipe buffers quota) we just
+         * keep the default size
+         */
+        fcntl (fd[1], F_SETPIPE_SZ, (int) size);
+    }
+    return 0;
+}
+
+static char *
+read_sys (int cpu, const char *file)
+{
+    char path[128], buf[BUF];
+    FILE *f;
+    if (cpu < 0)
+        snprintf (path, sizeof (path), "%s/%s", SYSCPU, file);
+    else
+        snprintf (path, sizeof (path), "%s/cpu%d/topology/%s", SYSCPU, cpu,
+                                                               file);
+    if ((f = fopen (path, "r")) == NULL)
+        return NULL;
+    if (fgets (buf, sizeof (buf), f) == NULL)
+        *buf = '\0';
+    fclose (f);
+    return xstrdup (buf);
+}
+
+static int
+read_sys_int (int cpu, const char *file)
+{
+    char *value = read_sys (cpu, file);
+    int ret = value != NULL ? strtol (value, NULL, 10) : 0;
+    xfree (value);
+    return ret;
+}
+
+/* Read once the topology of the CPUs the shell may use */
+static void
+init_topology (void)
+{
+    cpu_set_t allowed;
+    char *online = read_sys (-1, "online");
+    int *cpus, size, i;
+    nb_cpus = 0;
+    cpus = xstrranges (online, &size);
+    xfree (online);
+    if (cpus == NULL || sched_getaffinity (0, sizeof (allowed), &allowed) != 0)
+    {
+        xfree (cpus);
+        return;
+    }
+    topology = xcalloc (size, sizeof (cpu_topo));
+    for (i = 0; i < size; i++)
+    {
+        char *siblings;
+        int *sib, nb_sib, j;
+        cpu_topo *t = &topology[nb_cpus];
+        if (cpus[i] >= CPU_SETSIZE || !CPU_ISSET (cpus[i], &allowed))
+            continue;
+        t->cpu = cpus[i];
+        t->pkg = read_sys_int (cpus[i], "physical_package_id");
+        t->core = read_sys_int (cpus[i], "core_id");
+        t->smt = 0;
+        siblings = read_sys (cpus[i], "thread_siblings_list");
+        sib = xstrranges (siblings, &nb_sib);
+        for (j = 0; j < nb_sib; j++)
+            if (sib[j] < cpus[i])
+                t->smt++;
+        xfree (sib);
+        xfree (siblings);
+        nb_cpus++;
+    }
+    xfree (cpus);
+}
+
+/* neighbouring stages share a core, then a socket */
+static int
+cmp_compact (const void *p1, const void *p2)
+{
+    const cpu_topo *c1 = p1, *c2 = p2;
+    if (c1->pkg != c2->pkg)
+        return c1->pkg - c2->pkg;
+    if (c1->core != c2->core)
+        return c1->core - c2->core;
+    if (c1->smt != c2->smt)
+        return c1->smt - c2->smt;
+    return c1->cpu - c2->cpu;
+}
+
+/* neighbouring stages run on different sockets, then different cores */
+static int
+cmp_spread (const void *p1, const void *p2)
+{
+    const cpu_topo *c1 = p1, *c2 = p2;
+    if (c1->smt != c2->smt)
+        return c1->smt - c2->smt;
+    if (c1->core != c2->core)
+        return c1->core - c2->core;
+    if (c1->pkg != c2->pkg)
+        return c1->pkg - c2->pkg;
+    return c1->cpu - c2->cpu;
+}
+
+void
+clear_pipeline (void)
+{
+    xdebug (NULL);
+    xfree (topology);
+    topology = NULL;
+    nb_cpus = -1;
+}
+
+int *
+pipeline_cpus (int nb)
+{
+    const char *policy = get_option ("pipe.affinity");
+    int *ret = NULL, *list, size, i;
+    if (nb < 1 || policy == NULL || xstrcmp (policy, "none") == 0)
+        return NULL;
+    if (xstrcmp (policy, "compact") == 0 || xstrcmp (policy, "spread") == 0)
+    {
+        if (nb_cpus < 0)
+            init_topology ();
+        if (nb_cpus == 0)
+            return NULL;
+        qsort (topology, nb_cpus, sizeof (cpu_topo),
+               *policy == 'c' ? cmp_compact : cmp_spread);
+        ret = xcalloc (nb, sizeof (int));
+        for (i = 0; i < nb; i++)
+            ret[i] = topology[i % nb_cpus].cpu;
+        return ret;
+    }
+    if ((list = xstrranges (policy, &size)) == NULL)
+        return NULL;
+    ret = xcalloc (nb, sizeof (int));
+    for (i = 0; i < nb; i++)
+        ret[i] = list[i % size];
+    xfree (list);
+    return ret;
+}
+
+void
+pin_cpu (pid_t pid, int cpu)
+{
+    cpu_set_t set;
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return;
+    CPU_ZERO (&set);
+    CPU_SET (cpu, &set);
+    /* the CPU may be offline or forbidden: the command just runs anywhere */
+    sched_setaffinity (pid, sizeof (set), &set);
+}
+
+/**
+ * Close every descriptor but the standard ones and the given ones. Our helpers
+ * are forked but never exec'ed so they would otherwise keep the other ends of
+ * the pipes of the line opened
+ */
+static void
+close_fds_but (const int *keep, int nb)
+{
+    DIR *d = opendir ("/proc/self/fd");
+    struct dirent *e;
+    int dfd;
+    if (d == NULL)
+        return;
+    dfd = dirfd (d);
+    while ((e = readdir (d)) != NULL)
+    {
+        int fd, i;
+        unsigned int found = FALSE;
+        if (*e->d_name == '.')
+            continue;
+        fd = strtol (e->d_name, NULL, 10);
+        if (fd <= STDERR_FILENO || fd == dfd)
+            continue;
+        for (i = 0; i < nb && !found; i++)
+            found = (keep[i] == fd);
+        if (!found)
+            close (fd);
+    }
+    closedir (d);
+}
+
+void
+detach_child (const int *keep, int nb)
+{
+    evloop_forget ();
+    forget_jobs ();
+    close_fds_but (keep, nb);
+}
+
+pid_t
+fork_helper (const int *keep, int nb)
+{
+    pid_t r = fork ();
+    if (r == 0)
+    {
+        signal (SIGINT, SIG_DFL);
+        /* 
+         * a helper follows the commands it serves: if it was stopped along
+         * with them, continuing the job would leave it stopped
+         */
+        signal (SIGTSTP, SIG_IGN);
+        detach_child (keep, nb);
+    }
+    return r;
+}
+
+/* FNV-1a hash of the key-th blank separated field of the line */
+static unsigned int
+hash_line (const char *line, size_t len, int key)
+{
+    const char *p = line, *end = line + len;
+    unsigned int h = 2166136261u;
+    if (key > 0)
+    {
+        const char *start = end;
+        int f = 0;
+        while (p < end && f < key)
+        {
+            while (p < end && (*p == ' ' || *p == '\t'))
+                p++;
+            start = p;
+            while (p < end && *p != ' ' && *p != '\t')
+                p++;
+            if (start < p)
+                f++;
+        }
+        if (f < key)
+            start = end;
+        end = p;
+        p = start;
+    }
+    for (; p < end; p++)
+    {
+        h ^= (unsigned char) *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Buffer a line for the given copy, flushing the buffer when it is full */
+static int
+stage_line (int out, char *stage, size_t *staged, const char *line, size_t len)
+{
+    if (*staged + len > SHARD_CHUNK)
+    {
+        if (xwrite (out, stage, *staged) < 0)
+            return -1;
+        *staged = 0;
+    }
+    if (len > SHARD_CHUNK)
+        return xwrite (out, line, len);
+    memcpy (stage + *staged, line, len);
+    *staged += len;
+    return 0;
+}
+
+static void
+split_lines (int in, const int *outs, int nb, ShardSplit mode, int key)
+{
+    size_t size = SHARD_CHUNK * 4, len = 0;
+    char *buf = xmalloc (size);
+    char **stage = NULL;
+    size_t *staged = NULL;
+    int cur = 0, i;
+    if (mode == SHARD_HASH)
+    {
+        stage = xcalloc (nb, sizeof (char *));
+        staged = xcalloc (nb, sizeof (size_t));
+        for (i = 0; i < nb; i++)
+            stage[i] = xmalloc (SHARD_CHUNK);
+    }
+    while (1)
+    {
+        size_t done = 0;
+        ssize_t r = read (in, buf + len, size - len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        len += r;
+        while (done < len)
+        {
+            char *nl;
+            size_t n;
+            if (mode == SHARD_RR)
+            {
+                /* give each copy a block of whole lines */
+                size_t win = xmin (len - done, SHARD_CHUNK);
+                nl = memrchr (buf + done, '\n', win);
+                if (nl == NULL)
+                    nl = memchr (buf + done + win, '\n', len - done - win);
+                if (nl == NULL)
+                    break;
+                n = nl - (buf + done) + 1;
+                if (xwrite (outs[cur], buf + done, n) < 0)
+                    goto end;
+                cur = (cur + 1) % nb;
+            }
+            else
+            {
+                nl = memchr (buf + done, '\n', len - done);
+                if (nl == NULL)
+                    break;
+                n = nl - (buf + done) + 1;
+                i = hash_line (buf + done, n - 1, key) % nb;
+                if (stage_line (outs[i], stage[i], &staged[i],
+                                buf + done, n) < 0)
+                    goto end;
+            }
+            done += n;
+        }
+        memmove (buf, buf + done, len - done);
+        len -= done;
+        if (len == size)
+        {
+            size *= 2;
+            buf = xrealloc (buf, size);
+        }
+    }
+    /* the last line may not end with a '\n' */
+    if (len > 0)
+    {
+        if (mode == SHARD_RR)
+            xwrite (outs[cur], buf, len);
+        else
+        {
+            i = hash_line (buf, len, key) % nb;
+            stage_line (outs[i], stage[i], &staged[i], buf, len);
+        }
+    }
+    if (mode == SHARD_HASH)
+        for (i = 0; i < nb; i++)
+            if (staged[i] > 0 && xwrite (outs[i], stage[i], staged[i]) < 0)
+                break;
+end:
+    if (mode == SHARD_HASH)
+    {
+        for (i = 0; i < nb; i++)
+            xfree (stage[i]);
+        xfree (stage);
+        xfree (staged);
+    }
+    xfree (buf);
+}
+
+/* Write the lines of the copies as soon as they are complete */
+static void
+merge_lines (const int *ins, int nb, int out)
+{
+    struct pollfd *fds = xcalloc (nb, sizeof (*fds));
+    char **bufs = xcalloc (nb, sizeof (char *));
+    size_t *lens = xcalloc (nb, sizeof (size_t));
+    size_t *sizes = xcalloc (nb, sizeof (size_t));
+    int alive = nb, i;
+    for (i = 0; i < nb; i++)
+    {
+        fds[i].fd = ins[i];
+        fds[i].events = POLLIN;
+        sizes[i] = SHARD_CHUNK;
+        bufs[i] = xmalloc (sizes[i]);
+    }
+    while (alive > 0)
+    {
+        if (poll (fds, nb, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < nb; i++)
+        {
+            ssize_t r;
+            char *nl;
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            if (lens[i] == sizes[i])
+            {
+                sizes[i] *= 2;
+                bufs[i] = xrealloc (bufs[i], sizes[i]);
+            }
+            r = read (fds[i].fd, bufs[i] + lens[i], sizes[i] - lens[i]);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+            {
+                if (lens[i] > 0 && xwrite (out, bufs[i], lens[i]) < 0)
+                    goto end;
+                lens[i] = 0;
+                close (fds[i].fd);
+                fds[i].fd = -1;
+                alive--;
+                continue;
+            }
+            lens[i] += r;
+            nl = memrchr (bufs[i], '\n', lens[i]);
+            if (nl != NULL)
+            {
+                size_t n = nl - bufs[i] + 1;
+                if (xwrite (out, bufs[i], n) < 0)
+                    goto end;
+                memmove (bufs[i], bufs[i] + n, lens[i] - n);
+                lens[i] -= n;
+            }
+        }
+    }
+end:
+    for (i = 0; i < nb; i++)
+        xfree (bufs[i]);
+    xfree (bufs);
+    xfree (lens);
+    xfree (sizes);
+    xfree (fds);
+}
+
+/**
+ * Move the data available in the pipe 'in' to 'out', with splice when 'out'
+ * supports it
+ * @return The amount of data moved, 0 on EOF, -1 on error
+ */
+static ssize_t
+pump (int in, int out, unsigned int *spliceable)
+{
+    char buf[SHARD_CHUNK];
+    ssize_t r;
+    if (*spliceable)
+    {
+        r = splice (in, NULL, out, NULL, SHARD_CHUNK, SPLICE_F_MOVE);
+        if (r >= 0 || errno != EINVAL)
+            return r;
+        *spliceable = FALSE;
+    }
+    r = read (in, buf, sizeof (buf));
+    if (r > 0 && xwrite (out, buf, r) < 0)
+        return -1;
+    return r;
+}
+
+static int
+new_spool (void)
+{
+    char path[] = "/tmp/shelldone-XXXXXX";
+    int fd = mkstemp (path);
+    if (fd >= 0)
+        unlink (path);
+    return fd;
+}
+
+/* Copy the whole content of a spool file to 'out' */
+static int
+unspool (int fd, int out)
+{
+    off_t off = 0;
+    ssize_t r;
+    char buf[SHARD_CHUNK];
+    while ((r = sendfile (out, fd, &off, SHARD_CHUNK)) > 0);
+    if (r == 0)
+        return 0;
+    if (errno != EINVAL && errno != ENOSYS)
+        return -1;
+    while ((r = pread (fd, buf, sizeof (buf), off)) > 0)
+    {
+        if (xwrite (out, buf, r) < 0)
+            return -1;
+        off += r;
+    }
+    return r;
+}
+
+/**
+ * Write the output of each copy one after the other. The current copy is
+ * streamed, the others are spooled in temporary files until their turn comes.
+ * This is not the order of the input: a copy receives every nb-th block of
+ * lines (or every line of a hash), and nothing in the output of an arbitrary
+ * command tells which block a line comes from
+ */
+static void
+merge_grouped (const int *ins, int nb, int out)
+{
+    struct pollfd *fds = xcalloc (nb, sizeof (*fds));
+    int *spool = xcalloc (nb, sizeof (int));
+    unsigned int out_splice = TRUE, spool_splice = TRUE;
+    int head = 0, alive = nb, i;
+    for (i = 0; i < nb; i++)
+    {
+        fds[i].fd = ins[i];
+        fds[i].events = POLLIN;
+        spool[i] = -1;
+    }
+    while (alive > 0)
+    {
+        if (poll (fds, nb, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (i = 0; i < nb; i++)
+        {
+            ssize_t r;
+            if (fds[i].fd < 0 || fds[i].revents == 0)
+                continue;
+            if (i == head)
+                r = pump (fds[i].fd, out, &out_splice);
+            else
+            {
+                if (spool[i] < 0 && (spool[i] = new_spool ()) < 0)
+                {
+                    perror ("shelldone: spool");
+                    goto end;
+                }
+                r = pump (fds[i].fd, spool[i], &spool_splice);
+            }
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                goto end;
+            if (r == 0)
+            {
+                close (fds[i].fd);
+                fds[i].fd = -1;
+                alive--;
+            }
+        }
+        /* once the current copy is done, catch up with the next one */
+        while (head < nb && fds[head].fd < 0)
+        {
+            head++;
+            if (head < nb && spool[head] >= 0)
+            {
+                if (unspool (spool[head], out) < 0)
+                    goto end;
+                close (spool[head]);
+                spool[head] = -1;
+            }
+        }
+    }
+end:
+    for (i = 0; i < nb; i++)
+        if (spool[i] >= 0)
+            close (spool[i]);
+    xfree (spool);
+    xfree (fds);
+}
+
+pid_t
+shard_split (int in, const int *outs, int nb, ShardSplit mode, int key)
+{
+    int *keep = xcalloc (nb + 1, sizeof (int));
+    pid_t r;
+    memcpy (keep, outs, nb * sizeof (int));
+    keep[nb] = in;
+    r = fork_helper (keep, nb + 1);
+    xfree (keep);
+    if (r == 0)
+    {
+        split_lines (in, outs, nb, mode, key);
+        _exit (0);
+    }
+    return r;
+}
+
+pid_t
+shard_merge (const int *ins, int nb, int out, unsigned int grouped)
+{
+    int *keep = xcalloc (nb + 1, sizeof (int));
+    pid_t r;
+    memcpy (keep, ins, nb * sizeof (int));
+    keep[nb] = out;
+    r = fork_helper (keep, nb + 1);
+    xfree (keep);
+    if (r == 0)
+    {
+        if (grouped)
+            merge_grouped (ins, nb, out);
+        else
+            merge_lines (ins, nb, out);
+        _exit (0);
+    }
+    return r;
+}
@@ -0,0 +1,119 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <sys/types.h>
+
+/* Different ways to dispatch the lines between the copies of a stage */
+typedef enum {
+    /* blocks of lines are sent to each copy in turn */
+    SHARD_RR = 0,
+    /* a line always goes to the copy selected by the hash of its key */
+    SHARD_HASH
+} ShardSplit;
+
+/**
+ * Create a pipe for a command-line: both ends are closed on exec and the
+ * buffer is resized according to the 'pipe.size' option
+ * @param fd Array receiving the read and write ends of the pipe
+ * @return 0 on success, -1 on error
+ */
+int new_pipe (int fd[2]);
+
+/* Free the memory used by the pipelines helpers */
+void clear_pipeline (void);
+
+/**
+ * Choose the CPUs the processes of a line are pinned to, according to the
+ * 'pipe.affinity' option
+ * @param nb Number of processes in the line
+ * @return An allocated array of nb CPUs, or NULL if they are not pinned
+ */
+int *pipeline_cpus (int nb);
+
+/**
+ * Pin a process on the given CPU
+ * @param pid Process to pin (0 for the calling process)
+ * @param cpu CPU to pin the process on (if <0 the function returns)
+ */
+void pin_cpu (pid_t pid, int cpu);
+
+/**
+ * In a child forked to run shell code instead of a program (a helper, a
+ * forked builtin), close what exec would have closed: every descriptor but
+ * the standard ones and the given ones. Otherwise it keeps the other ends of
+ * the pipes of the line open, and a writer never sees EPIPE. The SIGCHLD
+ * handler of the shell is reset too
+ * @param keep Descriptors the child needs
+ * @param nb Number of descriptors in keep
+ */
+void detach_child (const int *keep, int nb);
+
+/**
+ * Fork a process running in the shell to help the commands of a line (ie. a
+ * splitter or a relay). The child only keeps the standard descriptors and the
+ * given ones
+ * @param keep Descriptors the child needs
+ * @param nb Number of descriptors in keep
+ * @return Same as fork
+ */
+pid_t fork_helper (const int *keep, int nb);
+
+/**
+ * Fork a process that reads lines on 'in' and dispatches them between the
+ * given descriptors, never cutting a line in the middle
+ * @param in Descriptor to read from
+ * @param outs Descriptors of the copies
+ * @param nb Number of copies
+ * @param mode How to choose the copy receiving a line
+ * @param key Field (starting at 1) to hash in SHARD_HASH mode, 0 for the whole
+ * line
+ * @return The pid of the splitter, -1 on error
+ */
+pid_t shard_split (int in, const int *outs, int nb, ShardSplit mode, int key);
+
+/**
+ * Fork a process that merges the outputs of the copies into 'out'
+ * @param ins Descriptors of the copies outputs
+ * @param nb Number of copies
+ * @param out Descriptor to write to
+ * @param grouped If TRUE the outputs are written one copy after the other
+ * (which is not the order of the input), otherwise lines are written as soon
+ * as they are complete
+ * @return The pid of the merger, -1 on error
+ */
+pid_t shard_merge (const int *ins, int nb, int out, unsigned int grouped);
+
+#endif
@@ -0,0 +1,296 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "relay.h"
+#include "pipeline.h"
+#include "xutils.h"
+
+#define RELAY_CHUNK (64 * 1024)
+/* bytes moved by the kernel at once, small enough to stop soon on ^C */
+#define COPY_CHUNK (16 * 1024 * 1024)
+
+typedef enum {
+    COPY_RANGE,
+    COPY_SENDFILE,
+    COPY_SPLICE
+} CopyMode;
+
+/* Fallback when the input is not a pipe */
+static int
+relay_copy (int in, const int *targets, int nb)
+{
+    char buf[RELAY_CHUNK];
+    ssize_t r;
+    int i;
+    while ((r = read (in, buf, sizeof (buf))) != 0)
+    {
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (i = 0; i < nb; i++)
+            if (xwrite (targets[i], buf, r) < 0)
+                return -1;
+    }
+    return 0;
+}
+
+/**
+ * Move exactly n bytes from the pipe 'from' to 'to', with splice when 'to'
+ * supports it
+ */
+static int
+drain (int from, int to, size_t n, unsigned int *spliceable)
+{
+    char buf[RELAY_CHUNK];
+    while (n > 0)
+    {
+        ssize_t r;
+        if (*spliceable)
+        {
+            r = splice (from, NULL, to, NULL, n, SPLICE_F_MOVE);
+            if (r < 0 && errno == EINVAL)
+            {
+                /* ie. 'to' is a terminal or a file opened with O_APPEND */
+                *spliceable = FALSE;
+                continue;
+            }
+        }
+        else
+        {
+            r = read (from, buf, n < sizeof (buf) ? n : sizeof (buf));
+            if (r > 0 && xwrite (to, buf, r) < 0)
+                return -1;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        n -= r;
+    }
+    return 0;
+}
+
+int
+relay (int in, const int *targets, int nb)
+{
+    struct stat st;
+    int (*scratch)[2];
+    unsigned int *spliceable;
+    int i, ret = 0;
+    long size;
+    if (nb < 1)
+        return 0;
+    if (fstat (in, &st) != 0 || !S_ISFIFO (st.st_mode) ||
+        (size = fcntl (in, F_GETPIPE_SZ)) <= 0)
+        return relay_copy (in, targets, nb);
+    /* 
+     * every target but the last one gets its copy through a scratch pipe as
+     * large as the input one: tee(2) then always duplicates the same amount
+     * of data in each of them
+     */
+    scratch = xcalloc (nb, sizeof (*scratch));
+    spliceable = xcalloc (nb, sizeof (unsigned int));
+    for (i = 0; i < nb; i++)
+    {
+        spliceable[i] = TRUE;
+        if (i == nb - 1)
+            break;
+        if (pipe2 (scratch[i], O_CLOEXEC) == -1)
+        {
+            nb = i;
+            ret = -1;
+            goto end;
+        }
+        fcntl (scratch[i][1], F_SETPIPE_SZ, (int) size);
+    }
+    while (1)
+    {
+        ssize_t n = size;
+        if (nb > 1)
+        {
+            n = tee (in, scratch[0][1], size, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                ret = n;
+                break;
+            }
+            for (i = 1; i < nb - 1; i++)
+                if (tee (in, scratch[i][1], n, 0) != n)
+                    break;
+            if (i < nb - 1)
+            {
+                ret = -1;
+                break;
+            }
+            for (i = 0; i < nb - 1; i++)
+                if (drain (scratch[i][0], targets[i], n, &spliceable[i]) < 0)
+                    break;
+            if (i < nb - 1)
+            {
+                ret = -1;
+                break;
+            }
+            /* the last target consumes the data */
+            if (drain (in, targets[nb - 1], n, &spliceable[nb - 1]) < 0)
+            {
+                ret = -1;
+                break;
+            }
+        }
+        else
+        {
+            if (spliceable[0])
+            {
+                n = splice (in, NULL, targets[0], NULL, size, SPLICE_F_MOVE);
+                if (n < 0 && errno == EINVAL)
+                {
+                    ret = relay_copy (in, targets, nb);
+                    break;
+                }
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                ret = n;
+                break;
+            }
+        }
+    }
+    nb--;
+end:
+    for (i = 0; i < nb; i++)
+    {
+        close (scratch[i][0]);
+        close (scratch[i][1]);
+    }
+    xfree (scratch);
+    xfree (spliceable);
+    return ret;
+}
+
+pid_t
+relay_start (int in, const int *targets, int nb)
+{
+    int *keep = xcalloc (nb + 1, sizeof (int));
+    pid_t r;
+    memcpy (keep, targets, nb * sizeof (int));
+    keep[nb] = in;
+    r = fork_helper (keep, nb + 1);
+    xfree (keep);
+    if (r == 0)
+        _exit (relay (in, targets, nb) == 0 ? 0 : 1);
+    return r;
+}
+
+/**
+ * Copy with one of the zero-copy syscalls
+ * @return 0 at the end of the input, -1 on error, 1 if the descriptors do not
+ * support this mode (some data may have been copied already)
+ */
+static int
+copy_kernel (CopyMode mode, int in, int out)
+{
+    while (1)
+    {
+        ssize_t r;
+        switch (mode)
+        {
+        case COPY_RANGE:
+            r = copy_file_range (in, NULL, out, NULL, COPY_CHUNK, 0);
+            break;
+        case COPY_SENDFILE:
+            r = sendfile (out, in, NULL, COPY_CHUNK);
+            break;
+        default:
+            r = splice (in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE);
+        }
+        if (r == 0)
+            return 0;
+        if (r > 0)
+            continue;
+        /* ie. other filesystems, O_APPEND outputs or terminals */
+        if (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+            errno == EOPNOTSUPP || errno == EBADF)
+            return 1;
+        return -1;
+    }
+}
+
+int
+copy_fd (int in, int out)
+{
+    struct stat si, so;
+    char buf[RELAY_CHUNK];
+    ssize_t r;
+    int ret = 1;
+    if (fstat (in, &si) != 0 || fstat (out, &so) != 0)
+        return -1;
+    /* /proc files claim to be empty: they are read like anything else */
+    if (S_ISREG(si.st_mode) && si.st_size > 0)
+    {
+        if (S_ISREG(so.st_mode))
+            ret = copy_kernel (COPY_RANGE, in, out);
+        if (ret == 1)
+            ret = copy_kernel (COPY_SENDFILE, in, out);
+    }
+    else if (S_ISFIFO(si.st_mode))
+        ret = copy_kernel (COPY_SPLICE, in, out);
+    if (ret < 0)
+        return -1;
+    /* 
+     * the read/write loop finishes what the kernel did not do, a file that
+     * changed size included
+     */
+    while ((r = read (in, buf, sizeof (buf))) > 0)
+        if (xwrite (out, buf, r) < 0)
+            return -1;
+    return r < 0 ? -1 : 0;
+}
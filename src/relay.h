@@ -0,0 +1,69 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+#include <sys/types.h>
+
+/**
+ * Copy everything read on 'in' to every target. When 'in' is a pipe the data
+ * is duplicated with tee(2) and moved with splice(2) so it never goes through
+ * userspace
+ * @param in Descriptor to read from
+ * @param targets Descriptors to write to
+ * @param nb Number of targets
+ * @return 0 on success, -1 on error
+ */
+int relay (int in, const int *targets, int nb);
+
+/**
+ * Fork a process relaying 'in' to the targets (cf. relay)
+ * @param in Descriptor to read from
+ * @param targets Descriptors to write to
+ * @param nb Number of targets
+ * @return The pid of the relay, -1 on error
+ */
+pid_t relay_start (int in, const int *targets, int nb);
+
+/**
+ * Copy everything read on 'in' to 'out', in the kernel when it can:
+ * copy_file_range(2) between files, sendfile(2) from a file, splice(2) from a
+ * pipe and read/write otherwise
+ * @param in Descriptor to read from
+ * @param out Descriptor to write to
+ * @return 0 on success, -1 on error (a signal interrupting the copy included)
+ */
+int copy_fd (int in, int out);
+
+#endif
@@ -0,0 +1,231 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "rlimits.h"
+#include "xutils.h"
+
+/* cf. linux/ioprio.h which is not always installed */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static const char *ioclasses[] = {"none", "realtime", "best-effort", "idle"};
+
+void
+init_limits (limits *lim)
+{
+    lim->mem = -1;
+    lim->cpu = -1;
+    lim->nice = 0;
+    lim->set_nice = FALSE;
+    lim->ioclass = 0;
+    lim->iolevel = 0;
+}
+
+/* Parse 'idle', 'best-effort[:level]' or 'realtime[:level]' */
+static int
+parse_ionice (const char *value, limits *lim)
+{
+    const char *level = strchr (value, ':');
+    size_t len = level != NULL ? (size_t) (level - value) : xstrlen (value);
+    int i;
+    for (i = 1; i < 4; i++)
+        if (xstrlen (ioclasses[i]) == len && 
+            strncmp (ioclasses[i], value, len) == 0)
+            break;
+    if (i == 4)
+        return -1;
+    lim->ioclass = i;
+    lim->iolevel = 4;
+    if (level != NULL)
+    {
+        char *end;
+        lim->iolevel = strtol (level + 1, &end, 10);
+        if (*end != '\0' || end == level + 1 || 
+            lim->iolevel < 0 || lim->iolevel > 7 || i == 3)
+            return -1;
+    }
+    return 0;
+}
+
+/* Parse the options of one 'limit' prefix, return the nb of words used */
+static int
+parse_prefix (int argc, char **argv, limits *lim)
+{
+    int i;
+    for (i = 0; i < argc; i++)
+    {
+        const char *opt = argv[i], *value = i + 1 < argc ? argv[i+1] : NULL;
+        char *end = NULL;
+        if (xstrcmp (opt, "--") == 0)
+            return i + 1;
+        if (xstrlen (opt) < 2 || strncmp (opt, "--", 2) != 0)
+            return i;
+        if (value == NULL)
+        {
+            fprintf (stderr, "limit: '%s' needs a value\n", opt);
+            return -1;
+        }
+        i++;
+        if (xstrcmp (opt, "--mem") == 0)
+        {
+            if ((lim->mem = xstrtosize (value)) > 0)
+                continue;
+        }
+        else if (xstrcmp (opt, "--cpu") == 0)
+        {
+            lim->cpu = strtol (value, &end, 10);
+            if (*end == '\0' && end != value && lim->cpu > 0)
+                continue;
+        }
+        else if (xstrcmp (opt, "--nice") == 0)
+        {
+            lim->nice = strtol (value, &end, 10);
+            lim->set_nice = TRUE;
+            if (*end == '\0' && end != value && 
+                lim->nice >= -20 && lim->nice <= 19)
+                continue;
+        }
+        else if (xstrcmp (opt, "--ionice") == 0)
+        {
+            if (parse_ionice (value, lim) == 0)
+                continue;
+        }
+        else
+        {
+            fprintf (stderr, "limit: '%s' unknown option\n", opt);
+            fprintf (stderr, "usage:\n\tlimit [--mem size] [--cpu seconds] "
+                             "[--nice n] [--ionice class[:level]] "
+                             "[--] command\n");
+            return -1;
+        }
+        fprintf (stderr, "limit: '%s' invalid value for '%s'\n", value, opt);
+        return -1;
+    }
+    return i;
+}
+
+int
+parse_limits (command *ptr)
+{
+    while (xstrcmp (ptr->cmd, "limit") == 0)
+    {
+        int n = parse_prefix (ptr->argc, ptr->argv, &ptr->lim), i;
+        if (n < 0)
+            return -1;
+        if (n >= ptr->argc)
+        {
+            fprintf (stderr, "limit: missing command\n");
+            return -1;
+        }
+        /* the first word after the options becomes the command */
+        xfree (ptr->cmd);
+        ptr->cmd = ptr->argv[n];
+        for (i = 0; i < n; i++)
+            xfree (ptr->argv[i]);
+        ptr->argc -= n + 1;
+        memmove (ptr->argv, ptr->argv + n + 1, ptr->argc * sizeof (char *));
+        memmove (ptr->protected, ptr->protected + n + 1,
+                 ptr->argc * sizeof (Protection));
+        ptr->argv[ptr->argc] = NULL;
+    }
+    return 0;
+}
+
+void
+apply_limits (const limits *lim)
+{
+    struct rlimit rl;
+    if (lim->mem > 0)
+    {
+        rl.rlim_cur = rl.rlim_max = lim->mem;
+        if (prlimit (0, RLIMIT_AS, &rl, NULL) != 0)
+            warn ("limit: --mem");
+    }
+    if (lim->cpu > 0)
+    {
+        rl.rlim_cur = lim->cpu;
+        /* leave some time to handle SIGXCPU before being killed */
+        rl.rlim_max = lim->cpu + 1;
+        if (prlimit (0, RLIMIT_CPU, &rl, NULL) != 0)
+            warn ("limit: --cpu");
+    }
+    if (lim->set_nice && setpriority (PRIO_PROCESS, 0, lim->nice) != 0)
+        warn ("limit: --nice");
+    if (lim->ioclass > 0 &&
+        syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                 lim->ioclass << IOPRIO_CLASS_SHIFT | lim->iolevel) != 0)
+        warn ("limit: --ionice");
+}
+
+unsigned int
+format_limits (const limits *lim, char *buf, size_t size)
+{
+    static const char units[] = "BKMG";
+    size_t len = 0;
+    buf[0] = '\0';
+    if (lim->mem > 0)
+    {
+        long mem = lim->mem;
+        int u = 0;
+        while (u < 3 && mem % 1024 == 0)
+        {
+            mem /= 1024;
+            u++;
+        }
+        len += snprintf (buf + len, size - len, " mem=%ld%c", mem, units[u]);
+    }
+    if (lim->cpu > 0)
+        len += snprintf (buf + len, size - len, " cpu=%lds", lim->cpu);
+    if (lim->set_nice)
+        len += snprintf (buf + len, size - len, " nice=%d", lim->nice);
+    if (lim->ioclass == 3)
+        len += snprintf (buf + len, size - len, " ionice=idle");
+    else if (lim->ioclass > 0)
+        len += snprintf (buf + len, size - len, " ionice=%s:%d",
+                         ioclasses[lim->ioclass], lim->iolevel);
+    return len > 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _RLIMITS_H_
+#define _RLIMITS_H_
+
+#include <stddef.h>
+
+#include "structs.h"
+
+/**
+ * Reset the given limits (ie. nothing is limited)
+ * @param lim Limits to reset
+ */
+void init_limits (limits *lim);
+
+/**
+ * Handle the 'limit' prefix of a command (ie. limit --mem 2G --cpu 60
+ * --nice 10 --ionice idle -- cmd): the options are stored in the limits of
+ * the command which then becomes 'cmd'
+ * @param ptr Command to handle
+ * @return 0 on success, -1 if the options are invalid
+ */
+int parse_limits (command *ptr);
+
+/**
+ * Apply limits to the current process (called before exec)
+ * @param lim Limits to apply
+ */
+void apply_limits (const limits *lim);
+
+/**
+ * Describe limits (ie. " mem=2G cpu=60s nice=10 ionice=idle")
+ * @param lim Limits to describe
+ * @param buf Buffer receiving the description
+ * @param size Size of the buffer (BUF is enough)
+ * @return FALSE if nothing is limited
+ */
+unsigned int format_limits (const limits *lim, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,394 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+/* the kernels are worth optimizing even in a debug build */
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__OPTIMIZE__)
+    #pragma GCC optimize ("O3")
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "scan.h"
+#include "xutils.h"
+
+/* pipes give at most their size per read, files give what is asked */
+#define SCAN_BLOCK (256 * 1024)
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[SCAN_BLOCK];
+} scan_out;
+
+static ssize_t
+scan_read (int in, char *buf, size_t len)
+{
+    ssize_t r;
+    do
+        r = read (in, buf, len);
+    while (r < 0 && errno == EINTR);
+    return r;
+}
+
+/* Gather the small writes of grep into big ones */
+static int
+out_add (scan_out *o, const char *data, size_t len)
+{
+    if (o->len + len > sizeof (o->buf))
+    {
+        if (xwrite (o->fd, o->buf, o->len) != 0)
+            return -1;
+        o->len = 0;
+        if (len > sizeof (o->buf))
+            return xwrite (o->fd, data, len);
+    }
+    memcpy (o->buf + o->len, data, len);
+    o->len += len;
+    return 0;
+}
+
+size_t
+scan_count (const char *buf, size_t len, char c)
+{
+    size_t n = 0, i = 0;
+#ifdef __SSE2__
+    const __m128i needle = _mm_set1_epi8 (c), zero = _mm_setzero_si128 ();
+    while (i + 16 <= len)
+    {
+        /* 
+         * the matches (0xff == -1) are summed in 16 byte-wide counters, which
+         * are added up before they overflow
+         */
+        __m128i acc = _mm_setzero_si128 (), sum;
+        size_t stop = len - i >= 255 * 16 ? i + 255 * 16 : len & ~(size_t) 15;
+        for (; i < stop; i += 16)
+        {
+            __m128i v = _mm_loadu_si128 ((const __m128i *) (buf + i));
+            acc = _mm_sub_epi8 (acc, _mm_cmpeq_epi8 (v, needle));
+        }
+        sum = _mm_sad_epu8 (acc, zero);
+        n += _mm_cvtsi128_si32 (sum) + _mm_cvtsi128_si32 (_mm_srli_si128 (sum,
+                                                                          8));
+    }
+#else
+    const char *p = buf, *end = buf + len;
+    while ((p = memchr (p, c, end - p)) != NULL)
+    {
+        n++;
+        p++;
+    }
+    i = len;
+#endif
+    for (; i < len; i++)
+        n += buf[i] == c;
+    return n;
+}
+
+long
+scan_lines (int in)
+{
+    char *buf = xmalloc (SCAN_BLOCK);
+    long n = 0;
+    ssize_t r;
+    while ((r = scan_read (in, buf, SCAN_BLOCK)) > 0)
+        n += scan_count (buf, r, '\n');
+    xfree (buf);
+    return r < 0 ? -1 : n;
+}
+
+int
+scan_head (int in, int out, long n)
+{
+    char *buf = xmalloc (SCAN_BLOCK);
+    ssize_t r = 0;
+    int ret = 0;
+    while (n > 0 && (r = scan_read (in, buf, SCAN_BLOCK)) > 0)
+    {
+        size_t len = r;
+        long c = scan_count (buf, len, '\n');
+        if (c >= n)
+        {
+            const char *p = buf;
+            for (; n > 0; n--)
+                p = (const char *) memchr (p, '\n', buf + len - p) + 1;
+            len = p - buf;
+        }
+        else
+            n -= c;
+        if (xwrite (out, buf, len) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    if (r < 0)
+        ret = -1;
+    /* do not let the writer fill a pipe nobody reads anymore */
+    close (in);
+    xfree (buf);
+    return ret;
+}
+
+/* Position after the k-th newline from the end of a buffer, NULL if fewer */
+static const char *
+back_lines (const char *buf, size_t len, long k)
+{
+    const char *p = buf + len;
+    for (; k > 0; k--)
+    {
+        p = memrchr (buf, '\n', p - buf);
+        if (p == NULL)
+            return NULL;
+    }
+    return p + 1;
+}
+
+/* Offset of the last n lines of a buffer (0 if there are not that many) */
+static size_t
+tail_start (const char *buf, size_t len, long n)
+{
+    const char *p;
+    if (n <= 0)
+        return len;
+    /* the newline ending the last line does not start a line */
+    if (len > 0 && buf[len - 1] == '\n')
+        len--;
+    p = back_lines (buf, len, n);
+    return p != NULL ? (size_t) (p - buf) : 0;
+}
+
+/* A regular file is scanned backwards from its end */
+static int
+tail_file (int in, int out, long n, off_t size)
+{
+    char *buf = xmalloc (SCAN_BLOCK);
+    off_t pos = size, start = n > 0 ? 0 : size;
+    ssize_t r;
+    long seen = 0;
+    while (pos > 0 && n > 0)
+    {
+        size_t len = pos > SCAN_BLOCK ? SCAN_BLOCK : pos, end;
+        long c;
+        pos -= len;
+        if (pread (in, buf, len, pos) != (ssize_t) len)
+        {
+            xfree (buf);
+            return -1;
+        }
+        end = len;
+        if (pos + (off_t) len == size && buf[len - 1] == '\n')
+            end--;
+        c = scan_count (buf, end, '\n');
+        if (seen + c < n)
+        {
+            seen += c;
+            continue;
+        }
+        start = pos + (back_lines (buf, end, n - seen) - buf);
+        break;
+    }
+    while (start < size && (r = pread (in, buf, SCAN_BLOCK, start)) > 0)
+    {
+        if (xwrite (out, buf, r) != 0)
+            break;
+        start += r;
+    }
+    xfree (buf);
+    return start < size ? -1 : 0;
+}
+
+int
+scan_tail (int in, int out, long n)
+{
+    struct stat st;
+    size_t cap = 4 * SCAN_BLOCK, len = 0, start;
+    char *buf;
+    ssize_t r;
+    int ret = 0;
+    if (fstat (in, &st) == 0 && S_ISREG(st.st_mode) && 
+        lseek (in, 0, SEEK_CUR) == 0)
+        return tail_file (in, out, n, st.st_size);
+    buf = xmalloc (cap);
+    while ((r = scan_read (in, buf + len, cap - len)) > 0)
+    {
+        len += r;
+        if (len < cap)
+            continue;
+        /* only keep what the last lines need */
+        start = tail_start (buf, len, n);
+        memmove (buf, buf + start, len - start);
+        len -= start;
+        if (len > cap / 2)
+        {
+            cap *= 2;
+            buf = xrealloc (buf, cap);
+        }
+    }
+    if (r < 0)
+        ret = -1;
+    start = tail_start (buf, len, n);
+    if (xwrite (out, buf + start, len - start) != 0)
+        ret = -1;
+    xfree (buf);
+    return ret;
+}
+
+/*
+ * Find a literal: the first and the last bytes of the literal are compared at
+ * 16 positions at once and only the positions matching both are checked
+ */
+static const char *
+scan_find (const char *buf, size_t len, const char *lit, size_t llen)
+{
+#ifdef __SSE2__
+    if (llen >= 2)
+    {
+        const __m128i first = _mm_set1_epi8 (lit[0]);
+        const __m128i last = _mm_set1_epi8 (lit[llen - 1]);
+        size_t i;
+        for (i = 0; i + llen - 1 + 16 <= len; i += 16)
+        {
+            __m128i a = _mm_loadu_si128 ((const __m128i *) (buf + i));
+            __m128i b = _mm_loadu_si128 ((const __m128i *) (buf + i + llen - 1));
+            unsigned int mask = _mm_movemask_epi8 (
+                                    _mm_and_si128 (_mm_cmpeq_epi8 (a, first),
+                                                   _mm_cmpeq_epi8 (b, last)));
+            while (mask != 0)
+            {
+                int bit = __builtin_ctz (mask);
+                if (memcmp (buf + i + bit + 1, lit + 1, llen - 2) == 0)
+                    return buf + i + bit;
+                mask &= mask - 1;
+            }
+        }
+        return memmem (buf + i, len - i, lit, llen);
+    }
+#endif
+    if (llen == 1)
+        return memchr (buf, lit[0], len);
+    return memmem (buf, len, lit, llen);
+}
+
+/* Copy the matching lines of a buffer made of whole lines */
+static long
+grep_lines (const char *buf, size_t len, const char *lit, size_t llen,
+            scan_out *o)
+{
+    const char *p = buf, *end = buf + len, *m;
+    long n = 0;
+    while (p < end && (m = scan_find (p, end - p, lit, llen)) != NULL)
+    {
+        const char *s = memrchr (p, '\n', m - p);
+        const char *e = (const char *) memchr (m, '\n', end - m) + 1;
+        s = s != NULL ? s + 1 : p;
+        if (out_add (o, s, e - s) != 0)
+            return -1;
+        p = e;
+        n++;
+    }
+    return n;
+}
+
+int
+scan_grep (int in, int out, const char *lit)
+{
+    size_t cap = SCAN_BLOCK, len = 0, llen = xstrlen (lit);
+    char *buf = xmalloc (cap);
+    scan_out *o = xmalloc (sizeof (scan_out));
+    long found = 0;
+    int ret = 0;
+    o->fd = out;
+    o->len = 0;
+    while (1)
+    {
+        ssize_t r = scan_read (in, buf + len, cap - len);
+        const char *nl;
+        size_t whole;
+        long n;
+        if (r < 0)
+        {
+            ret = -1;
+            break;
+        }
+        len += r;
+        /* like grep, the last line gets its newline */
+        if (r == 0 && len > 0 && buf[len - 1] != '\n')
+            buf[len++] = '\n';
+        nl = len > 0 ? memrchr (buf, '\n', len) : NULL;
+        if (nl == NULL)
+        {
+            if (r == 0)
+                break;
+            /* a line longer than the buffer */
+            if (len == cap)
+            {
+                cap *= 2;
+                buf = xrealloc (buf, cap);
+            }
+            continue;
+        }
+        whole = nl + 1 - buf;
+        n = grep_lines (buf, whole, lit, llen, o);
+        if (n < 0)
+        {
+            ret = -1;
+            break;
+        }
+        found += n;
+        memmove (buf, buf + whole, len - whole);
+        len -= whole;
+        if (r == 0)
+            break;
+        /* room for the newline added at the end */
+        if (len + 1 >= cap)
+        {
+            cap *= 2;
+            buf = xrealloc (buf, cap);
+        }
+    }
+    if (ret == 0 && xwrite (out, o->buf, o->len) != 0)
+        ret = -1;
+    xfree (o);
+    xfree (buf);
+    return ret < 0 ? -1 : found > 0 ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stddef.h>
+
+/**
+ * Count the occurrences of a byte, 16 bytes at a time when SSE2 is there
+ * @param buf Data to scan
+ * @param len Size of the data
+ * @param c Byte to count
+ * @return The nb of occurrences
+ */
+size_t scan_count (const char *buf, size_t len, char c);
+
+/**
+ * Count the lines read on a descriptor (wc -l)
+ * @param in Descriptor to read until the end
+ * @return The nb of newlines, -1 on error
+ */
+long scan_lines (int in);
+
+/**
+ * Copy the first lines of the input (head -n). The input is closed as soon as
+ * they are written so the writer gets SIGPIPE instead of filling the pipe
+ * @param in Descriptor to read from
+ * @param out Descriptor to write to
+ * @param n Nb of lines
+ * @return 0 on success, -1 on error
+ */
+int scan_head (int in, int out, long n);
+
+/**
+ * Copy the last lines of the input (tail -n). A regular file is read from its
+ * end
+ * @param in Descriptor to read from
+ * @param out Descriptor to write to
+ * @param n Nb of lines
+ * @return 0 on success, -1 on error
+ */
+int scan_tail (int in, int out, long n);
+
+/**
+ * Copy the lines containing a literal string (grep -F)
+ * @param in Descriptor to read from
+ * @param out Descriptor to write to
+ * @param lit String to look for
+ * @return 0 if a line matched, 1 if none did, -1 on error
+ */
+int scan_grep (int in, int out, const char *lit);
+
+#endif
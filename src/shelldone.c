@@ -50,6 +50,10 @@
 #include "command.h"
 #include "jobs.h"
 #include "modules.h"
+#include "options.h"
+#include "pipeline.h"
+#include "trace.h"
+#include "evloop.h"
 
 pid_t shell_pgid;
 int shell_terminal;
@@ -61,6 +65,10 @@ unsigned int running = FALSE;
 sigjmp_buf env;
 int val;
 char *plugindir;
+static char *oneshot = NULL;
+
+extern int ret_code;
+extern unsigned int last_line;
 
 static void shelldone_init (void);
 static void shelldone_clean (void);
@@ -86,6 +94,8 @@ shelldone_init (void)
     init_jobs ();
     /* initialize modules list */
     init_modules ();
+    /* initialize the shell options */
+    init_options ();
     /* ignoring SIGTSTP + handling SIGINT */
     struct sigaction sa;
     sa.sa_handler = siginthandler;
@@ -129,6 +139,10 @@ shelldone_clean (void)
     clear_history ();
     clear_jobs ();
     clear_modules ();
+    clear_options ();
+    clear_pipeline ();
+    clear_trace ();
+    clear_evloop ();
 }
 
 /**
@@ -169,9 +183,12 @@ shelldone_loop (void)
         {
             pt = "shell> ";
         }
-        list_jobs (FALSE, NULL, 0, FALSE);
+        /* the jobs that changed meanwhile, then as they do */
+        reap_jobs (FALSE);
+        watch_jobs (TRUE);
         /* read the input line */
         li = read_line (pt);
+        watch_jobs (FALSE);
         if (xstrcmp ("quit", li) == 0)
             break;
         if (xstrlen (li) > 0)
@@ -196,13 +213,14 @@ shelldone_read_args (int argc, char **argv)
         /*int this_option_optind = optind ? optind : 1;*/
         int option_index = 0;
         static struct option long_options[] = {
+                {"command", required_argument, 0, 'c'},
                 {"dir",     required_argument, 0, 'd'},
                 {"load",    required_argument, 0, 'l'},
                 {"help",    no_argument      , 0, 'h'},
                 {0,         0,                 0,  0 }
                 };
 
-        c = getopt_long(argc, argv, "d:l:h",
+        c = getopt_long(argc, argv, "c:d:l:h",
                         long_options, &option_index);
 
         if (c == -1)
@@ -210,6 +228,10 @@ shelldone_read_args (int argc, char **argv)
 
         switch (c)
         {
+        case 'c':
+            oneshot = optarg;
+            break;
+
         case 'd':
             plugindir = optarg;
             fprintf (stdout, "searching plugins in '%s'\n", plugindir);
@@ -237,6 +259,7 @@ to improve my programming skills and have some fun.\n\
 usage:\n\
     shelldone [-d|--dir=<where are the plugins>]\n\
               [-l|--load=plugin1[,plugin2[...]]]\n\
+              [-c|--command=<command-line to run>]\n\
               [-h|-?|--help]\n\
 \n\
 ");
@@ -265,6 +288,19 @@ main (int argc, char **argv)
     /* reading arguments */
     shelldone_read_args (argc, argv);
 
+    /* run the given command-line instead of reading them */
+    if (oneshot != NULL)
+    {
+        li = xstrdup (oneshot);
+        l = parse_line (li);
+        /* the last command can take the place of the shell */
+        last_line = TRUE;
+        run_line (l);
+        /* nobody would start the jobs still waiting for a slot */
+        flush_queue (0);
+        exit (ret_code);
+    }
+
     /* infinite loop waiting for commands to launch */
     shelldone_loop ();
 
@@ -70,7 +70,35 @@ typedef enum {
     SINGLE_QUOTE
 } Protection;
 
+/* Resource limits and priorities of a command (cf. the 'limit' prefix) */
+typedef struct _limits limits;
+
+struct _limits {
+    /* max size of the address space in bytes (-1 if none) */
+    long mem;
+    /* max CPU time in seconds (-1 if none) */
+    long cpu;
+    /* niceness */
+    int nice;
+    /* is the niceness changed */
+    unsigned int set_nice;
+    /* I/O scheduling class (0 if unchanged) */
+    int ioclass;
+    /* I/O priority within the class */
+    int iolevel;
+};
+
+/*
+ * A command is shared by the line that runs it, the job list and fg (cf.
+ * ref_command). Sharing is not immutability: every field stays writable by
+ * every holder. The run state (pid, pidfd, stopped, capture, relays...) is
+ * the one of the process they all refer to, so writing it is the point. What
+ * it runs (cmd, argv, argvf, redirections) is only to be changed by a holder
+ * that owns it alone (cf. own_command)
+ */
 struct _command {
+    /* nb of holders, it is freed when the last one lets it go */
+    int refs;
     /* command */
     char *cmd;
     /* arguments */
@@ -101,8 +129,32 @@ struct _command {
     unsigned int continued;
     /* pid of the command */
     pid_t pid;
+    /* pidfd taken when it was forked (-1 if none): never a recycled pid */
+    int pidfd;
     /* job id */
     int job;
+    /* nb of copies to run in parallel (cf. the '|N>' operator) */
+    int shards;
+    /* CPU to pin the command on (-1 if none) */
+    int cpu;
+    /* extra stdout targets (ie. cmd >a >b) */
+    int *outs;
+    /* nb extra stdout targets */
+    int nb_outs;
+    /* extra stderr targets (ie. cmd 2>a 2>b) */
+    int *errs;
+    /* nb extra stderr targets */
+    int nb_errs;
+    /* pid of the process copying stdout to its targets (-1 if none) */
+    pid_t relay_out;
+    /* pid of the process copying stderr to its targets (-1 if none) */
+    pid_t relay_err;
+    /* ring keeping the output of a background job (-1 if none) */
+    int capture;
+    /* resource limits and priorities */
+    limits lim;
+    /* when the command was started (cf. usage_clock), 0 if it was not */
+    double start;
 };
 
 struct _command_line {
@@ -0,0 +1,527 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+
+#include "throttle.h"
+#include "jobs.h"
+#include "evloop.h"
+#include "options.h"
+#include "xutils.h"
+#include "usage.h"
+
+/* seconds between two looks at the pressure */
+#define THROTTLE_TICK 2
+/* ticks after a job was throttled before one is continued again */
+#define THROTTLE_HOLD 5
+
+/* seconds in a period of the duty cycle of 'bg --cpu' */
+#define CAP_PERIOD 0.1
+
+/* Duty cycle of a job capped by 'bg --cpu' */
+struct _duty
+{
+    /* share of a CPU allowed, and got lately (%, -1 if not measured yet) */
+    int share;
+    double got;
+    /* stopped by the cycle, and when it switches next */
+    unsigned int paused;
+    double next;
+    /* running time in a period (s) */
+    double work;
+    /* start of the current period, and CPU time of the job then */
+    double start;
+    double cpu;
+};
+
+static int timer = -1;
+static int cap_timer = -1;
+
+static void cap_tick (int fd, void *data);
+
+static const char *resources[] = {"cpu", "memory", "io"};
+#define NB_RESOURCES (sizeof (resources) / sizeof (resources[0]))
+/* stall times (us) at the last tick and when it was */
+static long long stalls[NB_RESOURCES];
+static double last_tick = 0;
+static int hold = 0;
+
+/* "some total=" of a /proc/pressure file, -1 if there is none */
+static long long
+resource_stall (const char *name)
+{
+    char path[64], buf[BUF];
+    const char *p;
+    ssize_t r;
+    int fd;
+    snprintf (path, sizeof (path), "/proc/pressure/%s", name);
+    fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    r = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+    if (r <= 0)
+        return -1;
+    buf[r] = '\0';
+    if (strncmp (buf, "some ", 5) != 0 ||
+        (p = strstr (buf, "total=")) == NULL)
+        return -1;
+    return strtoll (p + 6, NULL, 10);
+}
+
+/*
+ * Highest share of time (%) some tasks were stalled on a resource since the
+ * last call, -1 if the kernel does not tell. avg10 would lag behind the jobs
+ * just stopped or continued
+ */
+static double
+read_pressure (void)
+{
+    double now = usage_clock (), ret = -1, p;
+    unsigned int i;
+    for (i = 0; i < NB_RESOURCES; i++)
+    {
+        long long total = resource_stall (resources[i]);
+        if (total < 0)
+            continue;
+        /* us stalled per s elapsed, the first time there is nothing yet */
+        p = last_tick > 0 && now > last_tick ?
+                (total - stalls[i]) / (now - last_tick) / 1e4 :
+                0;
+        if (p > ret)
+            ret = p;
+        stalls[i] = total;
+    }
+    last_tick = now;
+    return ret;
+}
+
+/* Call a function on each descendant of a process, parents first */
+static void
+walk_children (pid_t pid, void (*fn) (pid_t, void *), void *data)
+{
+    char path[BUF + 64];
+    struct dirent *task;
+    DIR *tasks;
+    snprintf (path, sizeof (path), "/proc/%d/task", (int) pid);
+    tasks = opendir (path);
+    if (tasks == NULL)
+        return;
+    while ((task = readdir (tasks)) != NULL)
+    {
+        char buf[BUF], *p, *end;
+        ssize_t r;
+        int fd;
+        if (task->d_name[0] == '.')
+            continue;
+        snprintf (path, sizeof (path), "/proc/%d/task/%s/children",
+                                       (int) pid,
+                                       task->d_name);
+        fd = open (path, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        r = read (fd, buf, sizeof (buf) - 1);
+        close (fd);
+        if (r <= 0)
+            continue;
+        buf[r] = '\0';
+        for (p = buf; ; p = end)
+        {
+            long child = strtol (p, &end, 10);
+            if (end == p)
+                break;
+            fn (child, data);
+            walk_children (child, fn, data);
+        }
+    }
+    closedir (tasks);
+}
+
+static void
+signal_child (pid_t pid, void *data)
+{
+    kill (pid, *(int *) data);
+}
+
+int
+kill_tree (const command *ptr, int sig)
+{
+    int ret;
+    /* kill (-1) would reach every process */
+    if (ptr->pid <= 0)
+        return -1;
+    /* stopped first, the root does not start new children meanwhile */
+    if (ptr->pidfd >= 0)
+        ret = syscall (SYS_pidfd_send_signal, ptr->pidfd, sig, NULL, 0);
+    else
+        ret = kill (ptr->pid, sig);
+    if (ret == 0)
+        walk_children (ptr->pid, signal_child, &sig);
+    return ret;
+}
+
+/* Add the CPU time (s) of a process, in ns from schedstat */
+static void
+add_cpu (pid_t pid, void *data)
+{
+    char path[64], buf[BUF];
+    ssize_t r;
+    int fd;
+    snprintf (path, sizeof (path), "/proc/%d/schedstat", (int) pid);
+    fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return;
+    r = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+    if (r <= 0)
+        return;
+    buf[r] = '\0';
+    *(double *) data += strtoull (buf, NULL, 10) / 1e9;
+}
+
+/* CPU time used by a job and its descendants still alive */
+static double
+tree_cpu (pid_t pid)
+{
+    double ret = 0;
+    add_cpu (pid, &ret);
+    walk_children (pid, add_cpu, &ret);
+    return ret;
+}
+
+/* Wake the loop up for the next switch of a duty cycle (-1: there is none) */
+static void
+arm_cap (double next)
+{
+    struct itimerspec its;
+    if (next < 0)
+    {
+        if (cap_timer >= 0)
+        {
+            evloop_del (cap_timer);
+            close (cap_timer);
+            cap_timer = -1;
+        }
+        return;
+    }
+    if (cap_timer < 0)
+    {
+        cap_timer = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+        if (cap_timer < 0)
+        {
+            warn ("bg: timerfd_create");
+            return;
+        }
+        if (evloop_add (cap_timer, cap_tick, NULL) != 0)
+        {
+            warn ("bg");
+            close (cap_timer);
+            cap_timer = -1;
+            return;
+        }
+    }
+    memset (&its, 0, sizeof (its));
+    /* 0 would disarm it: a switch already late goes at once */
+    its.it_value.tv_sec = (time_t) next;
+    its.it_value.tv_nsec = (long) ((next - (time_t) next) * 1e9);
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+        its.it_value.tv_nsec = 1;
+    timerfd_settime (cap_timer, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * Next step of the duty cycle of a job: at the end of a period, the share it
+ * got is measured and its running time in the next one scaled to reach the cap
+ */
+static void
+cycle_job (job *j, double now)
+{
+    duty *d = j->duty;
+    pid_t pid = j->content->pid;
+    if (!d->paused && d->work < CAP_PERIOD && now < d->start + CAP_PERIOD)
+    {
+        kill_tree (j->content, SIGSTOP);
+        d->paused = TRUE;
+        d->next = d->start + CAP_PERIOD;
+        return;
+    }
+    if (d->start > 0 && now > d->start)
+    {
+        double cpu = tree_cpu (pid);
+        double got = (cpu - d->cpu) / (now - d->start) * 100;
+        d->got = d->got < 0 ? got : d->got * 0.7 + got * 0.3;
+        d->cpu = cpu;
+        /* a job that does not use its share has nothing to be stopped for */
+        if (d->got > 0)
+            d->work *= d->share / d->got;
+        else
+            d->work = CAP_PERIOD;
+        if (d->work > CAP_PERIOD)
+            d->work = CAP_PERIOD;
+        if (d->work < CAP_PERIOD / 50)
+            d->work = CAP_PERIOD / 50;
+    }
+    else
+        d->cpu = tree_cpu (pid);
+    d->start = now;
+    if (d->paused)
+    {
+        kill_tree (j->content, SIGCONT);
+        d->paused = FALSE;
+    }
+    d->next = now + (d->work < CAP_PERIOD ? d->work : CAP_PERIOD);
+}
+
+static void
+cap_tick (int fd, void *data)
+{
+    double now = usage_clock (), next = -1;
+    unsigned long long ticks;
+    ssize_t r = read (fd, &ticks, sizeof (ticks));
+    job *tmp;
+    (void) r;
+    (void) data;
+    for (tmp = get_first_job (); tmp != NULL; tmp = tmp->next)
+    {
+        duty *d = tmp->duty;
+        if (d == NULL)
+            continue;
+        /*
+         * stopped by someone else (^Z, throttle) or not started yet: it
+         * starts over after
+         */
+        if (tmp->content->stopped || tmp->queued)
+        {
+            d->paused = FALSE;
+            d->start = 0;
+            d->next = now + CAP_PERIOD;
+        }
+        else if (d->next <= now)
+            cycle_job (tmp, now);
+        if (next < 0 || d->next < next)
+            next = d->next;
+    }
+    arm_cap (next);
+}
+
+void
+cap_job (job *ptr, int share)
+{
+    duty *d;
+    if (share <= 0)
+    {
+        uncap_job (ptr);
+        return;
+    }
+    if (ptr->duty == NULL)
+    {
+        ptr->duty = xcalloc (1, sizeof (duty));
+        ptr->duty->got = -1;
+    }
+    d = ptr->duty;
+    d->share = share;
+    d->work = CAP_PERIOD * share / 100;
+    if (d->work > CAP_PERIOD)
+        d->work = CAP_PERIOD;
+    d->start = 0;
+    d->next = usage_clock ();
+    arm_cap (d->next);
+}
+
+void
+uncap_job (job *ptr)
+{
+    if (ptr->duty == NULL)
+        return;
+    if (ptr->duty->paused && !ptr->content->stopped)
+        kill_tree (ptr->content, SIGCONT);
+    xfree (ptr->duty);
+    ptr->duty = NULL;
+}
+
+unsigned int
+format_cap (const job *ptr, char *buf, size_t size)
+{
+    if (ptr->duty == NULL)
+        return FALSE;
+    if (ptr->duty->got >= 0)
+        snprintf (buf, size, " cpu=%d%% got=%.1f%%", ptr->duty->share,
+                                                     ptr->duty->got);
+    else
+        snprintf (buf, size, " cpu=%d%%", ptr->duty->share);
+    return TRUE;
+}
+
+/* Stop the running job that started last */
+static void
+throttle_newest (void)
+{
+    job *tmp, *newest = NULL;
+    for (tmp = get_first_job (); tmp != NULL; tmp = tmp->next)
+        if (!tmp->queued && !tmp->foreground && !tmp->content->stopped &&
+            (newest == NULL || tmp->content->start > newest->content->start))
+            newest = tmp;
+    if (newest == NULL)
+        return;
+    newest->throttled = TRUE;
+    newest->content->stopped = TRUE;
+    kill_tree (newest->content, SIGSTOP);
+}
+
+/* Continue the throttled job that started first, or every one */
+static void
+release_oldest (unsigned int all)
+{
+    job *tmp, *oldest = NULL;
+    for (tmp = get_first_job (); tmp != NULL; tmp = tmp->next)
+    {
+        /* the jobs stopped with ^Z stay stopped */
+        if (!tmp->throttled || !tmp->content->stopped)
+            continue;
+        if (all)
+        {
+            tmp->throttled = FALSE;
+            tmp->content->stopped = FALSE;
+            kill_tree (tmp->content, SIGCONT);
+        }
+        else if (oldest == NULL ||
+                 tmp->content->start < oldest->content->start)
+            oldest = tmp;
+    }
+    if (oldest == NULL)
+        return;
+    oldest->throttled = FALSE;
+    oldest->content->stopped = FALSE;
+    kill_tree (oldest->content, SIGCONT);
+}
+
+/* One job at a time each tick: the others may be enough to relieve it */
+static void
+throttle_tick (int fd, void *data)
+{
+    unsigned long long ticks;
+    int high = get_option_int ("jobs.pressure");
+    double p;
+    ssize_t r = read (fd, &ticks, sizeof (ticks));
+    (void) r;
+    (void) data;
+    p = read_pressure ();
+    if (p < 0)
+        return;
+    if (hold > 0)
+        hold--;
+    if (p >= high)
+    {
+        throttle_newest ();
+        hold = THROTTLE_HOLD;
+    }
+    else if (p < high / 2.0 && hold == 0)
+        release_oldest (FALSE);
+}
+
+unsigned int
+throttle_active (void)
+{
+    return timer >= 0 || cap_timer >= 0;
+}
+
+/* Stop watching the pressure and continue the throttled jobs */
+static void
+stop_watching (void)
+{
+    if (timer < 0)
+        return;
+    evloop_del (timer);
+    close (timer);
+    timer = -1;
+    release_oldest (TRUE);
+}
+
+void
+clear_throttle (void)
+{
+    job *tmp;
+    for (tmp = get_first_job (); tmp != NULL; tmp = tmp->next)
+        uncap_job (tmp);
+    arm_cap (-1);
+    stop_watching ();
+}
+
+void
+throttle_configure (void)
+{
+    struct itimerspec its;
+    if (!option_is ("jobs.throttle", "on"))
+    {
+        stop_watching ();
+        return;
+    }
+    if (timer >= 0)
+        return;
+    last_tick = 0;
+    hold = 0;
+    if (read_pressure () < 0)
+    {
+        warnx ("throttle: no pressure information (/proc/pressure)");
+        return;
+    }
+    timer = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+    if (timer < 0)
+    {
+        warn ("throttle: timerfd_create");
+        return;
+    }
+    memset (&its, 0, sizeof (its));
+    its.it_value.tv_sec = THROTTLE_TICK;
+    its.it_interval.tv_sec = THROTTLE_TICK;
+    if (timerfd_settime (timer, 0, &its, NULL) != 0 ||
+        evloop_add (timer, throttle_tick, NULL) != 0)
+    {
+        warn ("throttle");
+        close (timer);
+        timer = -1;
+    }
+}
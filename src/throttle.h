@@ -0,0 +1,93 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _THROTTLE_H_
+#define _THROTTLE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "jobs.h"
+
+/**
+ * Start or stop watching the pressure on the system according to the
+ * 'jobs.throttle' and 'jobs.pressure' options. When it stops, the throttled
+ * jobs are continued
+ */
+void throttle_configure (void);
+
+/* Stop watching the pressure, lift the caps and continue the stopped jobs */
+void clear_throttle (void);
+
+/**
+ * Tell whether the pressure is watched or jobs are capped: the shell has to
+ * serve the event loop while it waits for a command
+ * @return TRUE if jobs.throttle is on or a job is capped
+ */
+unsigned int throttle_active (void);
+
+/**
+ * Send a signal to a command and to all its descendants (a job started with
+ * 'make &' is a whole tree). The command is reached through its pidfd when it
+ * has one
+ * @param ptr Command at the root of the tree
+ * @param sig Signal to send
+ * @return 0 on success, -1 with errno set if the command was not reached
+ */
+int kill_tree (const command *ptr, int sig);
+
+/**
+ * Cap the CPU share of a job (cf. bg --cpu): it is stopped and continued in
+ * turn, 10 times per second, the time it runs being adjusted to the share of
+ * CPU it gets
+ * @param ptr The job
+ * @param share % of a CPU, 0 to lift the cap
+ */
+void cap_job (job *ptr, int share);
+
+/**
+ * Lift the cap of a job, it is continued if the cap stopped it
+ * @param ptr The job
+ */
+void uncap_job (job *ptr);
+
+/**
+ * Describe the cap of a job (ie. " cpu=25% got=24.7%")
+ * @param ptr The job
+ * @param buf Buffer receiving the description
+ * @param size Size of the buffer
+ * @return TRUE if the job is capped
+ */
+unsigned int format_cap (const job *ptr, char *buf, size_t size);
+
+#endif
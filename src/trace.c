@@ -0,0 +1,475 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "trace.h"
+#include "options.h"
+#include "xutils.h"
+
+#define TRACE_MAGIC "SDTRACE"
+#define TRACE_VERSION 1
+/* smallest ring accepted */
+#define TRACE_MIN (16 * 1024)
+
+/* Header of a trace ring, followed by the events then by the strings */
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int event_size;
+    /* capacity of the ring of events */
+    unsigned long long nb_events;
+    /* size of the ring of strings */
+    unsigned long long str_size;
+    /* nb events ever recorded */
+    unsigned long long head;
+    /* nb bytes of strings ever recorded */
+    unsigned long long str_head;
+    /* pid of the shell */
+    int pid;
+    unsigned int pad;
+} trace_header;
+
+/* A fixed-size event */
+typedef struct {
+    /* monotonic time (ns) */
+    unsigned long long ts;
+    /* arguments of the event (cf. trace_ref) */
+    unsigned long long args;
+    unsigned int args_len;
+    unsigned int argc;
+    /* process recording the event */
+    int pid;
+    /* process concerned by the event */
+    int target;
+    /* exit status (TRACE_EXIT) */
+    int value;
+    /* TraceType, written last */
+    unsigned int type;
+} trace_event;
+
+static trace_header *ring = NULL;
+static size_t ring_size = 0;
+static char *ring_path = NULL;
+
+static unsigned long long
+now (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static trace_event *
+events_of (trace_header *h)
+{
+    return (trace_event *) (h + 1);
+}
+
+static char *
+strings_of (trace_header *h)
+{
+    return (char *) (events_of (h) + h->nb_events);
+}
+
+void
+clear_trace (void)
+{
+    xdebug (NULL);
+    if (ring != NULL)
+        munmap (ring, ring_size);
+    ring = NULL;
+    ring_size = 0;
+    xfree (ring_path);
+    ring_path = NULL;
+}
+
+/**
+ * Create the default file of the ring. Its name is predictable: it is never
+ * opened through a symlink, nor truncated unless it is ours
+ * @param file Path of the file
+ * @return A descriptor on the file, -1 on error
+ */
+static int
+create_default (const char *file)
+{
+    int flags = O_RDWR|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC;
+    int fd = open (file, flags, S_IRUSR|S_IWUSR);
+    /* left by a shell that had the same pid: a stranger's one stays */
+    if (fd < 0 && errno == EEXIST)
+    {
+        if (unlink (file) != 0)
+        {
+            errno = EEXIST;
+            return -1;
+        }
+        fd = open (file, flags, S_IRUSR|S_IWUSR);
+    }
+    return fd;
+}
+
+void
+trace_configure (void)
+{
+    const char *file = get_option ("trace.file");
+    size_t size = get_option_int ("trace.size");
+    char buf[BUF];
+    int fd;
+    unsigned int dflt = xstrlen (file) == 0;
+    if (size < TRACE_MIN)
+        size = TRACE_MIN;
+    if (dflt)
+    {
+        /* a directory of the user alone when there is one */
+        const char *dir = getenv ("XDG_RUNTIME_DIR");
+        if (xstrlen (dir) == 0)
+            dir = "/tmp";
+        snprintf (buf, sizeof (buf), "%s/shelldone-trace-%d", dir, getpid ());
+        file = buf;
+    }
+    if (!option_is ("trace", "on") || 
+        (ring != NULL && (size != ring_size || xstrcmp (file, ring_path) != 0)))
+        clear_trace ();
+    if (!option_is ("trace", "on") || ring != NULL)
+        return;
+    if (dflt)
+        fd = create_default (file);
+    else
+        fd = open (file, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+    if (fd < 0 || ftruncate (fd, size) != 0)
+    {
+        warn ("trace: %s", file);
+        if (fd >= 0)
+            close (fd);
+        return;
+    }
+    ring = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (ring == MAP_FAILED)
+    {
+        warn ("trace: %s", file);
+        ring = NULL;
+        return;
+    }
+    ring_size = size;
+    ring_path = xstrdup (file);
+    /* half of the ring for the events, the other half for the arguments */
+    memcpy (ring->magic, TRACE_MAGIC, sizeof (ring->magic));
+    ring->version = TRACE_VERSION;
+    ring->event_size = sizeof (trace_event);
+    ring->nb_events = (size - sizeof (trace_header)) / 2 / sizeof (trace_event);
+    ring->str_size = size - sizeof (trace_header) - 
+                     ring->nb_events * sizeof (trace_event);
+    ring->head = 0;
+    ring->str_head = 0;
+    ring->pid = getpid ();
+}
+
+const char *
+trace_path (void)
+{
+    return ring_path;
+}
+
+/* Reserve the next slot of the ring (processes forked by the shell share it) */
+static trace_event *
+new_event (void)
+{
+    unsigned long long i = __atomic_fetch_add (&ring->head, 1, 
+                                               __ATOMIC_RELAXED);
+    trace_event *ev = &events_of (ring)[i % ring->nb_events];
+    ev->type = 0;
+    ev->ts = now ();
+    ev->pid = getpid ();
+    ev->target = 0;
+    ev->value = 0;
+    ev->args = 0;
+    ev->args_len = 0;
+    ev->argc = 0;
+    return ev;
+}
+
+static void
+commit_event (trace_event *ev, TraceType type)
+{
+    __atomic_store_n (&ev->type, type, __ATOMIC_RELEASE);
+}
+
+/* Copy strings into the string ring, one after the other */
+static trace_ref
+store_strings (const char *first, char **strs, int nb)
+{
+    trace_ref ref = {0, 0, 0};
+    size_t len = first != NULL ? xstrlen (first) + 1 : 0, pos, l;
+    char *dst = strings_of (ring);
+    int i;
+    for (i = 0; i < nb; i++)
+        len += xstrlen (strs[i]) + 1;
+    /* do not let a single event wipe the whole ring */
+    if (len == 0 || len > ring->str_size / 4)
+        return ref;
+    ref.off = __atomic_fetch_add (&ring->str_head, len, __ATOMIC_RELAXED);
+    ref.len = len;
+    ref.argc = nb + (first != NULL);
+    for (i = -1, pos = 0; i < nb; i++)
+    {
+        const char *s = i < 0 ? first : strs[i];
+        size_t o, n;
+        if (i < 0 && first == NULL)
+            continue;
+        l = xstrlen (s) + 1;
+        o = (ref.off + pos) % ring->str_size;
+        n = l < ring->str_size - o ? l : ring->str_size - o;
+        memcpy (dst + o, s != NULL ? s : "", n);
+        if (n < l)
+            memcpy (dst, s + n, l - n);
+        pos += l;
+    }
+    return ref;
+}
+
+void
+trace_parse (const char *line)
+{
+    trace_event *ev;
+    trace_ref ref;
+    if (ring == NULL)
+        return;
+    ev = new_event ();
+    ref = store_strings (line, NULL, 0);
+    ev->args = ref.off;
+    ev->args_len = ref.len;
+    ev->argc = ref.argc;
+    commit_event (ev, TRACE_PARSE);
+}
+
+trace_ref
+trace_expand (const command *ptr)
+{
+    trace_ref ref = {0, 0, 0};
+    trace_event *ev;
+    if (ring == NULL || ptr == NULL)
+        return ref;
+    ev = new_event ();
+    ref = store_strings (ptr->cmd, ptr->argvf, ptr->argcf);
+    ev->args = ref.off;
+    ev->args_len = ref.len;
+    ev->argc = ref.argc;
+    commit_event (ev, TRACE_EXPAND);
+    return ref;
+}
+
+void
+trace_command (TraceType type, pid_t pid, trace_ref args)
+{
+    trace_event *ev;
+    if (ring == NULL)
+        return;
+    ev = new_event ();
+    ev->target = pid;
+    ev->args = args.off;
+    ev->args_len = args.len;
+    ev->argc = args.argc;
+    commit_event (ev, type);
+}
+
+void
+trace_exit (pid_t pid, int status)
+{
+    trace_event *ev;
+    if (ring == NULL)
+        return;
+    ev = new_event ();
+    ev->target = pid;
+    ev->value = status;
+    commit_event (ev, TRACE_EXIT);
+}
+
+/**
+ * Get the arguments of an event, separated by spaces
+ * @return A new allocated string, NULL if they were overwritten
+ */
+static char *
+load_strings (trace_header *h, const trace_event *ev)
+{
+    const char *src = strings_of (h);
+    char *ret;
+    unsigned int i;
+    if (ev->args_len == 0 || ev->args + h->str_size < h->str_head)
+        return NULL;
+    ret = xmalloc (ev->args_len);
+    for (i = 0; i < ev->args_len; i++)
+    {
+        ret[i] = src[(ev->args + i) % h->str_size];
+        if (ret[i] == '\0' && i + 1 < ev->args_len)
+            ret[i] = ' ';
+    }
+    ret[ev->args_len - 1] = '\0';
+    return ret;
+}
+
+static void
+print_json_string (FILE *out, const char *s)
+{
+    fputc ('"', out);
+    for (; s != NULL && *s != '\0'; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf (out, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            fprintf (out, "\\u%04x", *s);
+        else
+            fputc (*s, out);
+    }
+    fputc ('"', out);
+}
+
+static const char *
+type_name (unsigned int type)
+{
+    static const char *names[] = {"?", "parse", "expand", "spawn", "exec",
+                                  "exit"};
+    return type <= TRACE_EXIT ? names[type] : names[0];
+}
+
+int
+trace_dump (const char *path, unsigned int json, FILE *out)
+{
+    struct stat st;
+    trace_header *h;
+    unsigned long long i, first, start = 0;
+    int fd = open (path, O_RDONLY|O_CLOEXEC);
+    unsigned int sep = FALSE;
+    if (fd < 0)
+        return -1;
+    if (fstat (fd, &st) != 0 || (size_t) st.st_size < sizeof (trace_header))
+    {
+        close (fd);
+        return -1;
+    }
+    h = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (h == MAP_FAILED)
+        return -1;
+    if (memcmp (h->magic, TRACE_MAGIC, sizeof (h->magic)) != 0 ||
+        h->version != TRACE_VERSION || 
+        h->event_size != sizeof (trace_event) ||
+        sizeof (trace_header) + h->nb_events * sizeof (trace_event) + 
+            h->str_size > (unsigned long long) st.st_size)
+    {
+        munmap (h, st.st_size);
+        return -1;
+    }
+    first = h->head > h->nb_events ? h->head - h->nb_events : 0;
+    if (json)
+        fprintf (out, "{\"traceEvents\":[\n");
+    for (i = first; i < h->head; i++)
+    {
+        const trace_event *ev = &events_of (h)[i % h->nb_events];
+        char *args;
+        if (ev->type == 0)
+            continue;
+        if (start == 0)
+            start = ev->ts;
+        args = load_strings (h, ev);
+        if (json)
+        {
+            /* the life of a process is a duration event of its own thread */
+            const char *ph = ev->type == TRACE_SPAWN ? "B" :
+                             ev->type == TRACE_EXIT ? "E" : "i";
+            int tid = ev->type == TRACE_SPAWN || ev->type == TRACE_EXIT ?
+                      ev->target : ev->pid;
+            fprintf (out, "%s{\"name\":", sep ? ",\n" : "");
+            print_json_string (out, ev->type == TRACE_SPAWN && args != NULL ?
+                                    args : type_name (ev->type));
+            fprintf (out, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%llu.%03llu,"
+                          "\"pid\":%d,\"tid\":%d",
+                     type_name (ev->type), ph, ev->ts / 1000, ev->ts % 1000, 
+                     h->pid, tid);
+            if (*ph == 'i')
+                fprintf (out, ",\"s\":\"t\"");
+            fprintf (out, ",\"args\":{");
+            if (args != NULL)
+            {
+                fprintf (out, "\"argv\":");
+                print_json_string (out, args);
+            }
+            if (ev->type == TRACE_EXIT)
+                fprintf (out, "%s\"status\":%d", args != NULL ? "," : "",
+                         WIFEXITED(ev->value) ? WEXITSTATUS(ev->value) :
+                                                128 + WTERMSIG(ev->value));
+            fprintf (out, "}}");
+            sep = TRUE;
+        }
+        else
+        {
+            fprintf (out, "[%5llu.%06llu] %6d %-6s", 
+                     (ev->ts - start) / 1000000000ULL,
+                     (ev->ts - start) / 1000ULL % 1000000ULL,
+                     ev->pid, type_name (ev->type));
+            if (ev->type == TRACE_SPAWN || ev->type == TRACE_EXIT)
+                fprintf (out, " %d", ev->target);
+            if (ev->type == TRACE_EXIT)
+            {
+                if (WIFEXITED(ev->value))
+                    fprintf (out, " returned %d", WEXITSTATUS(ev->value));
+                else if (WIFSIGNALED(ev->value))
+                    fprintf (out, " signal %d", WTERMSIG(ev->value));
+            }
+            if (args != NULL)
+                fprintf (out, " %s", args);
+            else if (ev->args_len > 0)
+                fprintf (out, " (overwritten)");
+            fprintf (out, "\n");
+        }
+        xfree (args);
+    }
+    if (json)
+        fprintf (out, "\n]}\n");
+    munmap (h, st.st_size);
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "structs.h"
+
+/* Phases of the execution recorded in the trace (cf. 'set -x') */
+typedef enum {
+    /* a line was parsed */
+    TRACE_PARSE = 1,
+    /* the plugins expanded the arguments of a command */
+    TRACE_EXPAND,
+    /* the shell forked a command */
+    TRACE_SPAWN,
+    /* a command is about to be executed */
+    TRACE_EXEC,
+    /* the shell collected the exit status of a command */
+    TRACE_EXIT
+} TraceType;
+
+/* Reference to arguments already stored in the trace */
+typedef struct {
+    /* position in the string ring */
+    unsigned long long off;
+    /* size of the arguments (NUL included) */
+    unsigned int len;
+    /* nb arguments */
+    unsigned int argc;
+} trace_ref;
+
+/* Clear the trace ring */
+void clear_trace (void);
+
+/**
+ * Open or close the trace ring according to the 'trace', 'trace.size' and
+ * 'trace.file' options
+ */
+void trace_configure (void);
+
+/**
+ * Record the parsing of a line
+ * @param line Line parsed
+ */
+void trace_parse (const char *line);
+
+/**
+ * Record the arguments of a command once expanded by the plugins
+ * @param ptr Command expanded
+ * @return A reference to the arguments for the following events
+ */
+trace_ref trace_expand (const command *ptr);
+
+/**
+ * Record an event about a command
+ * @param type Kind of event (TRACE_SPAWN or TRACE_EXEC)
+ * @param pid Process concerned
+ * @param args Arguments of the command (cf. trace_expand)
+ */
+void trace_command (TraceType type, pid_t pid, trace_ref args);
+
+/**
+ * Record the end of a command
+ * @param pid Process that ended
+ * @param status Status returned by waitpid
+ */
+void trace_exit (pid_t pid, int status);
+
+/**
+ * Get the path of the current trace ring
+ * @return The path or NULL if the trace is off
+ */
+const char *trace_path (void);
+
+/**
+ * Render a trace ring
+ * @param path File containing the ring
+ * @param json TRUE for the Chrome trace format, FALSE for text
+ * @param out Stream to write to
+ * @return 0 on success, -1 if the file is not a trace ring
+ */
+int trace_dump (const char *path, unsigned int json, FILE *out);
+
+#endif
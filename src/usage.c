@@ -0,0 +1,171 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "usage.h"
+#include "xutils.h"
+
+/* Read a /proc file of a process, small enough for the buffer */
+static unsigned int
+read_proc (pid_t pid, const char *name, char *buf, size_t size)
+{
+    char path[64];
+    ssize_t r;
+    int fd;
+    snprintf (path, sizeof (path), "/proc/%d/%s", (int) pid, name);
+    fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return FALSE;
+    r = read (fd, buf, size - 1);
+    close (fd);
+    if (r <= 0)
+        return FALSE;
+    buf[r] = '\0';
+    return TRUE;
+}
+
+/* Value of a "\nkey: value" line (cf. /proc/<pid>/status and io) */
+static long
+proc_field (const char *buf, const char *key)
+{
+    const char *p = strstr (buf, key);
+    if (p == NULL)
+        return -1;
+    return strtol (p + strlen (key), NULL, 10);
+}
+
+void
+format_size (long size, char *buf, size_t len)
+{
+    static const char units[] = "KMGT";
+    double s = size / 1024.0;
+    int u = 0;
+    while (u < 3 && s >= 1024)
+    {
+        s /= 1024;
+        u++;
+    }
+    snprintf (buf, len, "%.1f%c", s, units[u]);
+}
+
+double
+usage_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned int
+sample_usage (pid_t pid, job_usage *u)
+{
+    char buf[BUF * 8];
+    const char *p;
+    unsigned long utime, stime;
+    long rss, r, w;
+    if (!read_proc (pid, "stat", buf, sizeof (buf)))
+        return FALSE;
+    /* the name of the command may hold anything but it ends with a ')' */
+    p = strrchr (buf, ')');
+    if (p == NULL ||
+        sscanf (p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu "
+                       "%*d %*d %*d %*d %*d %*d %*u %*u %ld",
+                &utime, &stime, &rss) != 3)
+        return FALSE;
+    u->elapsed = -1;
+    u->cpu = (double) (utime + stime) / sysconf (_SC_CLK_TCK);
+    u->rss = rss * sysconf (_SC_PAGESIZE);
+    u->maxrss = -1;
+    u->inblock = -1;
+    u->oublock = -1;
+    if (read_proc (pid, "status", buf, sizeof (buf)) &&
+        (r = proc_field (buf, "\nVmHWM:")) >= 0)
+        u->maxrss = r * 1024;
+    /* only readable by the owner of the process */
+    if (read_proc (pid, "io", buf, sizeof (buf)) &&
+        (r = proc_field (buf, "\nread_bytes:")) >= 0 &&
+        (w = proc_field (buf, "\nwrite_bytes:")) >= 0)
+    {
+        u->inblock = r / 512;
+        u->oublock = w / 512;
+    }
+    return TRUE;
+}
+
+void
+rusage_usage (const struct rusage *ru, job_usage *u)
+{
+    u->elapsed = -1;
+    u->cpu = ru->ru_utime.tv_sec + ru->ru_stime.tv_sec +
+             (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1e6;
+    u->rss = -1;
+    u->maxrss = ru->ru_maxrss * 1024;
+    u->inblock = ru->ru_inblock;
+    u->oublock = ru->ru_oublock;
+}
+
+unsigned int
+format_usage (const job_usage *u, char *buf, size_t size)
+{
+    char tmp[32];
+    size_t len = 0;
+    buf[0] = '\0';
+    if (u->elapsed >= 0)
+        len += snprintf (buf + len, size - len, " time=%.1fs", u->elapsed);
+    if (u->cpu >= 0)
+        len += snprintf (buf + len, size - len, " cpu=%.2fs", u->cpu);
+    if (u->rss >= 0)
+    {
+        format_size (u->rss, tmp, sizeof (tmp));
+        len += snprintf (buf + len, size - len, " rss=%s", tmp);
+    }
+    if (u->maxrss >= 0)
+    {
+        format_size (u->maxrss, tmp, sizeof (tmp));
+        len += snprintf (buf + len, size - len, " maxrss=%s", tmp);
+    }
+    if (u->inblock >= 0)
+        len += snprintf (buf + len, size - len, " in=%ld out=%ld",
+                         u->inblock, u->oublock);
+    return len > 0;
+}
@@ -0,0 +1,99 @@
+/**
+ * Shelldone
+ *
+ * vim:ts=4:sw=4:expandtab
+ *
+ * Copyright (c) 2011, Ziirish <mr.ziirish@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *    This product includes software developed by Ziirish.
+ * 4. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Ziirish ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Ziirish BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _USAGE_H_
+#define _USAGE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* What a job used (a field is -1 when unknown) */
+typedef struct _job_usage job_usage;
+
+struct _job_usage {
+    /* time since the start, or run time once ended, in seconds */
+    double elapsed;
+    /* CPU time (user + system) in seconds */
+    double cpu;
+    /* resident set size in bytes (running jobs only) */
+    long rss;
+    /* peak resident set size in bytes */
+    long maxrss;
+    /* 512-byte blocks read and written by the file systems */
+    long inblock;
+    long oublock;
+};
+
+/**
+ * Time on the monotonic clock, to date the start of a command
+ * @return The time in seconds
+ */
+double usage_clock (void);
+
+/**
+ * Sample what a running process used so far from /proc/<pid>/stat, status and
+ * io (elapsed is left unknown)
+ * @param pid PID of the process
+ * @param u Receives the figures
+ * @return FALSE if the process is gone
+ */
+unsigned int sample_usage (pid_t pid, job_usage *u);
+
+/**
+ * Figures of an ended process from what wait4 returned (elapsed is left
+ * unknown)
+ * @param ru Resource usage of the process and its waited children
+ * @param u Receives the figures
+ */
+void rusage_usage (const struct rusage *ru, job_usage *u);
+
+/**
+ * Describe what a job used (ie. " time=3.2s cpu=1.20s rss=12.0M maxrss=15.5M
+ * in=0 out=80")
+ * @param u Figures to describe
+ * @param buf Buffer receiving the description
+ * @param size Size of the buffer (BUF is enough)
+ * @return FALSE if nothing is known
+ */
+unsigned int format_usage (const job_usage *u, char *buf, size_t size);
+
+/**
+ * Describe a size in bytes with a unit (ie. 12.0M)
+ * @param size Size in bytes
+ * @param buf Buffer receiving the description
+ * @param len Size of the buffer
+ */
+void format_size (long size, char *buf, size_t len);
+
+#endif
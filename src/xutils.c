@@ -40,6 +40,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <err.h>
+#include <errno.h>
+#include <ctype.h>
 #include <stdarg.h>
 
 #include "xutils.h"
@@ -397,3 +399,95 @@ xadebug (const char *file, const char *func, int line, const char *format, ...)
 
     return;
 }
+
+int *
+xstrranges (const char *src, int *size)
+{
+    int *ret = NULL;
+    const char *p = src;
+    *size = 0;
+    if (xstrlen (src) == 0)
+        return NULL;
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long a, b;
+        if (!isdigit ((unsigned char) *p))
+            goto error;
+        a = b = strtol (p, &end, 10);
+        if (*end == '-')
+        {
+            p = end + 1;
+            if (!isdigit ((unsigned char) *p))
+                goto error;
+            b = strtol (p, &end, 10);
+        }
+        /* we don't want to allocate insane amounts of memory */
+        if (b < a || b - a > 4096 || *size + b - a > 4096)
+            goto error;
+        if (*end != ',' && *end != '\0' && *end != '\n')
+            goto error;
+        ret = xrealloc (ret, (*size + b - a + 1) * sizeof (int));
+        for (; a <= b; a++, (*size)++)
+            ret[*size] = a;
+        p = (*end == ',') ? end + 1 : end;
+    }
+    if (*size > 0)
+        return ret;
+error:
+    xfree (ret);
+    *size = 0;
+    return NULL;
+}
+
+int
+xwrite (int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0)
+    {
+        ssize_t r = write (fd, p, len);
+        if (r < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += r;
+        len -= r;
+    }
+    return 0;
+}
+
+long
+xstrtosize (const char *src)
+{
+    char *end;
+    long ret;
+    if (src == NULL || !isdigit (*src))
+        return -1;
+    errno = 0;
+    ret = strtol (src, &end, 10);
+    if (errno != 0)
+        return -1;
+    if (*end != '\0' && *(end + 1) == '\0')
+    {
+        switch (*end)
+        {
+        case 'g':
+        case 'G':
+            ret *= 1024;
+            /* fall through */
+        case 'm':
+        case 'M':
+            ret *= 1024;
+            /* fall through */
+        case 'k':
+        case 'K':
+            ret *= 1024;
+            end++;
+            break;
+        }
+    }
+    return *end == '\0' ? ret : -1;
+}
@@ -178,4 +178,29 @@ void xadebug (const char *file,
  */
 char **xstrsplitspace (const char *src, size_t *size);
 
+/**
+ * Parses a list of integers and ranges of integers (ie. "0,2,4-7")
+ * @param src The string to parse
+ * @param size Pointer that will contains the size of the returned array
+ * @return An array of integers or NULL if the list is invalid
+ */
+int *xstrranges (const char *src, int *size);
+
+/**
+ * Parses a size in bytes, optionally suffixed by K, M or G (ie. "64M")
+ * @param src The string to parse
+ * @return The size or -1 if the string is invalid
+ */
+long xstrtosize (const char *src);
+
+/**
+ * Writes the whole buffer to the given descriptor, retrying on short writes
+ * and interruptions
+ * @param fd Descriptor to write to
+ * @param buf Data to write
+ * @param len Size of the data
+ * @return 0 on success, -1 on error (errno is set)
+ */
+int xwrite (int fd, const void *buf, size_t len);
+
 #endif
@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Compares the ways shelldone waits for the end of background jobs: 'wait'
+# goes through the event loop (a pidfd per job, cf. the 'loop.backend'
+# option) while 'fg %1; fg %2...' blocks in waitpid on one job after the
+# other. Each line starts JOBS jobs running JOB and waits for all of them; the
+# time of a line includes the start of the shell and of the jobs, which are the
+# same for every variant
+
+SHELLDONE=${SHELLDONE:-../src/shelldone}
+JOBS=${JOBS:-50}
+RUNS=${RUNS:-20}
+JOB=${JOB:-"/bin/sleep 0.05"}
+BACKENDS=${BACKENDS:-"io_uring epoll"}
+
+start_jobs=""
+fg_jobs=""
+for i in $(seq 1 $JOBS)
+do
+    start_jobs="$start_jobs $JOB &"
+    fg_jobs="$fg_jobs fg %$i;"
+done
+
+# bench LABEL LINE
+bench ()
+{
+    local start end
+    start=$(date +%s%N)
+    for i in $(seq 1 $RUNS)
+    do
+        $SHELLDONE -c "$2" >/dev/null 2>&1
+    done
+    end=$(date +%s%N)
+    awk -v l="$1" -v r="$RUNS" -v t=$((end - start)) \
+        'BEGIN { printf "%-28s %8.2f ms per line\n", l, t / r / 1e6 }'
+}
+
+echo "Waiting for $JOBS jobs running '$JOB', $RUNS lines each"
+echo
+
+for backend in $BACKENDS
+do
+    bench "wait, loop.backend $backend" \
+          "set loop.backend $backend; $start_jobs wait"
+done
+bench "fg one job after the other" "$start_jobs $fg_jobs"
@@ -0,0 +1,27 @@
+#!/bin/bash
+
+# Measures the throughput of a 'dd | cat | wc -c' line run by shelldone for
+# several sizes of pipe buffer (cf. the 'pipe.size' option) and several CPU
+# placement policies (cf. the 'pipe.affinity' option)
+
+SHELLDONE=${SHELLDONE:-../src/shelldone}
+COUNT=${COUNT:-2048}
+SIZES=${SIZES:-"0 128K 256K 512K 1M"}
+POLICIES=${POLICIES:-"none compact spread"}
+
+echo "Moving $COUNT MiB through 'dd | cat | wc -c'"
+echo
+
+for policy in $POLICIES
+do
+    for size in $SIZES
+    do
+        start=$(date +%s%N)
+        $SHELLDONE -c "set pipe.size $size; set pipe.affinity $policy; \
+dd if=/dev/zero bs=1M count=$COUNT status=none | cat | wc -c" >/dev/null
+        end=$(date +%s%N)
+        awk -v p="$policy" -v s="$size" -v c="$COUNT" -v t=$((end - start)) \
+            'BEGIN { printf "pipe.affinity %-8s pipe.size %-6s %8.1f MiB/s\n",
+                     p, s, c / (t / 1e9) }'
+    done
+done
@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# Runs lines through shelldone and checks their output. Each line must end
+# within TIMEOUT seconds: a command which keeps a pipe of its line open makes
+# the writers upstream of head block forever instead of getting EPIPE
+
+SHELLDONE=${SHELLDONE:-../src/shelldone}
+TIMEOUT=${TIMEOUT:-5}
+failed=0
+
+# check_status LINE STATUS
+check_status ()
+{
+    timeout $TIMEOUT $SHELLDONE -c "$1" >/dev/null 2>&1
+    local rc=$?
+    if [ $rc -ne $2 ]
+    then
+        echo "FAIL $1: exited with $rc, expected $2"
+        failed=$((failed + 1))
+    else
+        echo "ok   $1"
+    fi
+}
+
+# check LINE EXPECTED
+check ()
+{
+    local got
+    got=$(timeout $TIMEOUT $SHELLDONE -c "$1" 2>&1)
+    local rc=$?
+    if [ $rc -eq 124 ]
+    then
+        echo "FAIL $1: hung"
+        failed=$((failed + 1))
+    elif [ "$got" != "$2" ]
+    then
+        echo "FAIL $1: got '$got', expected '$2'"
+        failed=$((failed + 1))
+    else
+        echo "ok   $1"
+    fi
+}
+
+# builtins forked for a pipe, upstream of head
+check "yes | grep -F y | head -1" "y"
+check "yes | tee /dev/null | head -1" "y"
+check "seq 1 100000 | grep 5 | head -2" "$(printf '5\n15')"
+
+# light builtins, forked when piped
+check "yes | cat | head -1" "y"
+check "yes | cat | cat | head -1" "y"
+check "seq 1 3 | cat | cat" "$(printf '1\n2\n3')"
+
+# sharded stages: no copy keeps the pipes of the others open, and no line
+# is lost even if they do not come out in input order (shard.merge is
+# unordered: which lines head gets first is up to the scheduler)
+check "seq 1 200000 |3> cat | head -3 | wc -l" "3"
+check "seq 1 200000 |3> /bin/cat | head -3 | wc -l" "3"
+check "seq 1 200000 |3> /bin/cat | sort -n | md5sum" "$(seq 1 200000 | md5sum)"
+check "set shard.merge grouped; seq 1 200000 |3> cat | wc -l" "200000"
+
+# and as the last command of the line
+check "seq 1 3 | grep -v 2" "$(printf '1\n3')"
+check "seq 1 100 | tail -2" "$(printf '99\n100')"
+check "seq 1 10 | wc -l" "10"
+
+# fg reports a job killed by a signal as 128 + the signal
+killed=$(mktemp /tmp/pipetest-XXXXXX.sh)
+printf '#!/bin/sh\nsleep 0.3\nkill -TERM $$\n' >$killed
+chmod +x $killed
+check_status "$killed & fg %1" 143
+check_status "$killed & sleep 0.1 & fg %2 %1" 143
+check_status "sleep 0.1 & $killed & fg %2 %1" 0
+
+# wait returns 0 without operand, the status of the last operand otherwise
+check_status "$killed & wait" 0
+check_status "$killed & sleep 0.1 & wait %2 %1" 143
+check_status "sleep 0.1 & $killed & wait %2 %1" 0
+rm -f $killed
+
+[ $failed -eq 0 ] && echo "all passed" || echo "$failed failed"
+exit $((failed != 0))
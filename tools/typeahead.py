@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+
+# Types a line while shelldone waits for a job in a terminal, and checks that
+# the shell sleeps meanwhile: what is typed ahead stays in the terminal until
+# the next prompt instead of waking up every wait of the shell
+
+import os
+import pty
+import select
+import signal
+import sys
+import time
+
+SHELLDONE = os.environ.get('SHELLDONE', '../src/shelldone')
+# CPU ticks the shell may take while the line waits
+MAX_TICKS = int(os.environ.get('MAX_TICKS', '10'))
+
+
+def pump(fd, seconds):
+    out = b''
+    end = time.time() + seconds
+    while time.time() < end:
+        r, _, _ = select.select([fd], [], [], 0.02)
+        if r:
+            try:
+                out += os.read(fd, 65536)
+            except OSError:
+                break
+    return out
+
+
+def type_line(fd, line):
+    # one key at a time, like somebody typing
+    out = b''
+    for key in line:
+        os.write(fd, bytes([key]))
+        out += pump(fd, 0.01)
+    return out
+
+
+def ticks(pid):
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return int(fields[11]) + int(fields[12])
+
+
+def main():
+    rd, wr = os.pipe()
+    pid, fd = pty.fork()
+    if pid == 0:
+        # the shell wants its own process group in the foreground
+        signal.signal(signal.SIGTTOU, signal.SIG_IGN)
+        child = os.fork()
+        if child == 0:
+            os.setpgid(0, 0)
+            os.tcsetpgrp(0, os.getpgrp())
+            signal.signal(signal.SIGTTOU, signal.SIG_DFL)
+            os.execv(SHELLDONE, [SHELLDONE])
+        os.write(wr, b'%d\n' % child)
+        os.waitpid(child, 0)
+        os._exit(0)
+    shell = int(os.read(rd, 64))
+    out = pump(fd, 0.5)
+    for line in (b'/bin/sleep 3 &\n', b'wait\n'):
+        out += type_line(fd, line)
+        out += pump(fd, 0.3)
+    out += type_line(fd, b'echo typed-ahead\n')
+    before = ticks(shell)
+    out += pump(fd, 1.5)
+    spent = ticks(shell) - before
+    out += pump(fd, 2)
+    out += type_line(fd, b'exit\n')
+    out += pump(fd, 0.5)
+    try:
+        os.kill(shell, signal.SIGKILL)
+    except OSError:
+        pass
+    os.waitpid(pid, 0)
+    if spent > MAX_TICKS:
+        print('FAIL wait with type-ahead: %d ticks in 1.5s' % spent)
+        return 1
+    if out.count(b'typed-ahead') < 2:
+        print('FAIL wait with type-ahead: the typed line did not run')
+        return 1
+    print('ok   wait with type-ahead: %d ticks in 1.5s' % spent)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())